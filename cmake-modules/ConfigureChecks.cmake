@@ -1,8 +1,18 @@
 include(CheckIncludeFile)
 include(CheckSymbolExists)
+include(CheckLibraryExists)
 
 check_symbol_exists(scandir dirent.h HAVE_SCANDIR)
 check_symbol_exists(alphasort dirent.h HAVE_ALPHASORT) 
 check_include_file (error.h HAVE_ERROR_H)
 check_include_file (search.h HAVE_TSEARCH)
 check_include_file (stdint.h HAVE_STDINT_H)
+
+# clock_gettime() is in librt with older glibc:
+check_library_exists(rt clock_gettime "" HAVE_LIBRT)
+if (HAVE_LIBRT)
+  set(CMAKE_REQUIRED_LIBRARIES rt)
+endif (HAVE_LIBRT)
+check_symbol_exists(clock_gettime time.h HAVE_CLOCK_GETTIME)
+check_symbol_exists(nanosleep time.h HAVE_NANOSLEEP)
+set(CMAKE_REQUIRED_LIBRARIES)
@@ -5,7 +5,9 @@ set(T4K_SRC_ROOT ${CMAKE_SOURCE_DIR}/src)
 #Source files for T4K_Common library
 set(T4K_COMMON_SOURCES
     ${T4K_SRC_ROOT}/t4k_audio.c
+    ${T4K_SRC_ROOT}/t4k_cache.c
     ${T4K_SRC_ROOT}/t4k_convert_utf.c
+    ${T4K_SRC_ROOT}/t4k_kernels.c
     ${T4K_SRC_ROOT}/t4k_linewrap.c
     ${T4K_SRC_ROOT}/t4k_loaders.c
     ${T4K_SRC_ROOT}/t4k_main.c
@@ -13,7 +15,10 @@ set(T4K_COMMON_SOURCES
     ${T4K_SRC_ROOT}/t4k_pixels.c
     ${T4K_SRC_ROOT}/t4k_replacements.c
     ${T4K_SRC_ROOT}/t4k_sdl.c
+    ${T4K_SRC_ROOT}/t4k_threads.c
     ${T4K_SRC_ROOT}/t4k_throttle.c
+    ${T4K_SRC_ROOT}/t4k_framestats.c
+    ${T4K_SRC_ROOT}/t4k_perfhud.c
     )
 
 #Header files for T4K_Common library
@@ -30,3 +35,8 @@ set(T4K_COMMON_HEADERS
 set(T4K_TEST_SOURCES
     ${T4K_SRC_ROOT}/t4k_test.c
     )
+
+#Source files for the t4k_bench benchmark program
+set(T4K_BENCH_SOURCES
+    ${T4K_SRC_ROOT}/t4k_bench.c
+    )
@@ -1,6 +1,8 @@
 #cmakedefine HAVE_ERROR_H 1
 #cmakedefine HAVE_SCANDIR 1
 #cmakedefine HAVE_ALPHASORT 1
+#cmakedefine HAVE_CLOCK_GETTIME 1
+#cmakedefine HAVE_NANOSLEEP 1
 
 #cmakedefine HAVE_GETTEXT 1
 #cmakedefine ENABLE_NLS 1
@@ -0,0 +1,546 @@
+/*
+   t4k_bench.c
+
+   Benchmark program for the t4k_common library. It runs headless (on
+   SDL's "dummy" video driver unless SDL_VIDEODRIVER says otherwise),
+   times the library's main drawing and loading functions on made-up
+   images and text, and prints the results as JSON on stdout, so they
+   can be kept and compared from one release to the next.
+
+   Copyright 2010.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+t4k_bench.c is part of the t4k_common library.
+
+t4k_common is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+t4k_common is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "config.h"
+#include "t4k_common.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BENCH_W 800
+#define BENCH_H 600
+#define NUM_PNGS 8
+#define PATH_LEN 1024
+
+static int iterations = 20;
+static int num_results = 0;
+static char data_dir[PATH_LEN - 32];
+static char images_dir[PATH_LEN - 16];
+
+static SDL_Surface* make_surface(int w, int h, int alpha);
+static void start_result(const char* name);
+static void end_result(const char* name, int n, Uint64 ns);
+static void skip_result(const char* name, const char* why);
+static int make_data_dir(void);
+static void remove_data_dir(void);
+static int write_png(const char* path, int w, int h, int seed);
+static int write_svg(const char* path);
+
+static void bench_zoom(void);
+static void bench_blend(void);
+static void bench_flip(void);
+static void bench_buttons(void);
+static void bench_text(void);
+static void bench_load(void);
+static void bench_linewrap(void);
+static void bench_prerender(void);
+
+
+int main(int argc, char* argv[])
+{
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+	if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+	{
+	    fprintf(stderr, "\nt4k_bench, a benchmark program for the t4k_common library.\n"
+		    "Run program with:\n"
+		    "--iterations N, -n N   - Repeat each test N times (default 20).\n"
+		    "--help, -h             - Display this help message.\n"
+		    "Results are written to stdout as JSON.\n\n");
+	    exit(0);
+	}
+	else if ((strcmp(argv[i], "--iterations") == 0 || strcmp(argv[i], "-n") == 0)
+		&& i + 1 < argc)
+	{
+	    iterations = atoi(argv[++i]);
+	    if (iterations < 1)
+		iterations = 1;
+	}
+	else
+	    fprintf(stderr, "Unknown option: %s\n", argv[i]);
+    }
+
+    /* no display needed: */
+    if (!getenv("SDL_VIDEODRIVER"))
+	putenv("SDL_VIDEODRIVER=dummy");
+
+    if (InitT4KCommon(0) != 1)
+    {
+	fprintf(stderr, "t4k_bench: InitT4KCommon() failed\n");
+	return 1;
+    }
+    screen = SDL_SetVideoMode(BENCH_W, BENCH_H, 32, SDL_SWSURFACE);
+    if (!screen)
+    {
+	fprintf(stderr, "t4k_bench: SDL_SetVideoMode() failed: %s\n", SDL_GetError());
+	return 1;
+    }
+
+    printf("{\n  \"program\": \"t4k_bench\",\n  \"version\": \"%s\",\n", VERSION);
+    printf("  \"screen\": \"%dx%dx%d\",\n  \"iterations\": %d,\n",
+	    screen->w, screen->h, screen->format->BitsPerPixel, iterations);
+    printf("  \"results\": [");
+
+    bench_zoom();
+    bench_blend();
+    bench_flip();
+    bench_buttons();
+    bench_text();
+    if (make_data_dir())
+	bench_load();
+    else
+	skip_result("load_image", "could not write test images");
+    remove_data_dir();
+    bench_linewrap();
+    bench_prerender();
+
+    printf("\n  ]\n}\n");
+
+    CleanupT4KCommon();
+    return 0;
+}
+
+
+/* Time 'what' 'iterations' times, recording it under 'name' */
+#define TIME(name, what) \
+    do { \
+	Uint64 t0_; \
+	int i_; \
+	start_result(name); \
+	t0_ = T4K_GetTimeNS(); \
+	for (i_ = 0; i_ < iterations; i_++) \
+	{ \
+	    what; \
+	} \
+	end_result(name, iterations, T4K_GetTimeNS() - t0_); \
+    } while (0)
+
+
+static void bench_zoom(void)
+{
+    SDL_Surface* src = make_surface(640, 480, 1);
+    SDL_Surface* s;
+
+    TIME("zoom_640x480_to_800x600", s = T4K_zoom(src, 800, 600); SDL_FreeSurface(s));
+    TIME("zoom_640x480_to_160x120", s = T4K_zoom(src, 160, 120); SDL_FreeSurface(s));
+    TIME("zoom_area_640x480_to_160x120",
+	    s = T4K_zoomEx(src, 160, 120, T4K_ZOOM_AREA); SDL_FreeSurface(s));
+    SDL_FreeSurface(src);
+}
+
+
+static void bench_blend(void)
+{
+    SDL_Surface* s1 = make_surface(BENCH_W, BENCH_H, 1);
+    SDL_Surface* s2 = make_surface(BENCH_W, BENCH_H, 1);
+    SDL_Surface* s;
+    SDL_Rect r;
+
+    TIME("blend_800x600", s = T4K_Blend(s1, s2, 0.3); SDL_FreeSurface(s));
+    TIME("blend_fade_800x600", s = T4K_Blend(s1, NULL, 0.3); SDL_FreeSurface(s));
+    TIME("blend_into_screen_800x600", T4K_BlendInto(screen, s1, s2, 0.3, NULL));
+    SDL_FreeSurface(s1);
+    SDL_FreeSurface(s2);
+
+    /* a sprite (in the screen's format, as the loaders leave them) drawn */
+    /* with SDL's alpha blitter, then premultiplied with ours              */
+    s1 = make_surface(128, 128, 1);
+    s = SDL_DisplayFormatAlpha(s1);
+    SDL_FreeSurface(s1);
+    TIME("blit_alpha_128x128", r.x = 100; r.y = 100; SDL_BlitSurface(s, NULL, screen, &r));
+    T4K_PremultiplyAlpha(s);
+    TIME("blit_premultiplied_128x128", r.x = 100; r.y = 100;
+	    T4K_BlitPremultiplied(s, NULL, screen, &r));
+    SDL_FreeSurface(s);
+}
+
+
+static void bench_flip(void)
+{
+    SDL_Surface* src = make_surface(320, 240, 1);
+    SDL_Surface* s;
+
+    TIME("flip_x_320x240", s = T4K_Flip(src, 1, 0); SDL_FreeSurface(s));
+    TIME("flip_y_320x240", s = T4K_Flip(src, 0, 1); SDL_FreeSurface(s));
+    SDL_FreeSurface(src);
+}
+
+
+static void bench_buttons(void)
+{
+    SDL_Surface* s = make_surface(200, 60, 1);
+    SDL_Surface* b;
+    SDL_Rect r = {100, 100, 200, 60};
+
+    TIME("round_corners_200x60", T4K_RoundCorners(s, 16));
+    TIME("create_button_200x60", b = T4K_CreateButton(200, 60, 16, 0x40, 0x80, 0xc0, 0xa0);
+	    SDL_FreeSurface(b));
+    TIME("fill_rounded_rect_200x60", T4K_FillRoundedRect(screen, &r, 16, 0x40, 0x80, 0xc0, 0xa0));
+    SDL_FreeSurface(s);
+}
+
+
+static void bench_text(void)
+{
+    SDL_Color white = {0xff, 0xff, 0xff};
+    const char* text = "The quick brown fox jumps over the lazy dog 0123456789";
+    SDL_Surface* s;
+
+    s = T4K_SimpleText(text, 24, &white);
+    if (!s)
+    {
+	skip_result("simple_text_24", "no font");
+	skip_result("black_outline_24", "no font");
+	return;
+    }
+    SDL_FreeSurface(s);
+
+    TIME("simple_text_24", s = T4K_SimpleText(text, 24, &white); SDL_FreeSurface(s));
+    TIME("black_outline_24", s = T4K_BlackOutline(text, 24, &white); SDL_FreeSurface(s));
+}
+
+
+/* PNGs are cached by file name once loaded, so the cold test loads */
+/* each of the other NUM_PNGS - 1 files once.                        */
+static void bench_load(void)
+{
+    char fn[PATH_LEN];
+    SDL_Surface* s;
+    Uint64 t0;
+    int i;
+
+    s = T4K_LoadImage("bench0.png", IMG_ALPHA | IMG_NOT_REQUIRED);
+    if (!s)
+    {
+	skip_result("load_png_256x256_cold", "no PNG support");
+	skip_result("load_png_256x256_cached", "no PNG support");
+    }
+    else
+    {
+	SDL_FreeSurface(s);
+
+	start_result("load_png_256x256_cold");
+	t0 = T4K_GetTimeNS();
+	for (i = 1; i < NUM_PNGS; i++)
+	{
+	    snprintf(fn, PATH_LEN, "bench%d.png", i);
+	    s = T4K_LoadImage(fn, IMG_ALPHA | IMG_NOT_REQUIRED);
+	    if (s)
+		SDL_FreeSurface(s);
+	}
+	end_result("load_png_256x256_cold", NUM_PNGS - 1, T4K_GetTimeNS() - t0);
+
+	TIME("load_png_256x256_cached", s = T4K_LoadImage("bench0.png", IMG_ALPHA);
+		if (s) SDL_FreeSurface(s));
+    }
+
+    s = T4K_LoadImage("bench.svg", IMG_ALPHA | IMG_NOT_REQUIRED | IMG_NO_PNG_FALLBACK);
+    if (!s)
+    {
+	skip_result("load_svg_256x256", "no SVG support");
+	return;
+    }
+    SDL_FreeSurface(s);
+    TIME("load_svg_256x256", s = T4K_LoadScaledImage("bench.svg",
+		IMG_ALPHA | IMG_NOT_REQUIRED | IMG_NO_PNG_FALLBACK, 256, 256);
+	    if (s) SDL_FreeSurface(s));
+}
+
+
+static void bench_linewrap(void)
+{
+    static char lines[MAX_LINES][MAX_LINEWIDTH];
+    char text[4096];
+    int i;
+
+    text[0] = '\0';
+    for (i = 0; i < 60; i++)
+	strcat(text, "Tux likes fish and snow, and counting stars. ");
+
+    TIME("linewrap_2700_chars_40_wide", T4K_LineWrap(text, lines, 40, MAX_LINES, MAX_LINEWIDTH));
+}
+
+
+static void bench_prerender(void)
+{
+    char* names[] = {"Play", "Options", "Help", "High Scores", "Credits",
+	"Project Info", "Settings", "Quit"};
+    SDL_Surface* s;
+
+    /* T4K_PrerenderAll() needs the menu's arrow and stop images: */
+    s = T4K_LoadImage("menu/stop.svg", IMG_ALPHA | IMG_NOT_REQUIRED);
+    if (!s)
+    {
+	skip_result("prerender_all", "menu images not installed");
+	return;
+    }
+    SDL_FreeSurface(s);
+
+    T4K_CreateOneLevelMenu(0, 8, names, NULL, "Benchmark", NULL);
+    TIME("prerender_all", T4K_PrerenderAll());
+}
+
+
+
+/* A w x h surface of noise, with alpha if asked for */
+static SDL_Surface* make_surface(int w, int h, int alpha)
+{
+    SDL_Surface* s = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, 32,
+	    rmask, gmask, bmask, alpha ? amask : 0);
+    Uint32* p;
+    int x, y;
+
+    if (!s)
+    {
+	fprintf(stderr, "t4k_bench: out of memory\n");
+	exit(1);
+    }
+    for (y = 0; y < h; y++)
+    {
+	p = (Uint32*)((Uint8*)s->pixels + y * s->pitch);
+	for (x = 0; x < w; x++)
+	    p[x] = (x * 7 + y * 13) ^ (rand() << 8) ^ rand();
+    }
+    return s;
+}
+
+
+static void start_result(const char* name)
+{
+    DEBUGMSG(debug_all, "t4k_bench: running %s\n", name);
+}
+
+
+static void end_result(const char* name, int n, Uint64 ns)
+{
+    printf("%s\n    {\"name\": \"%s\", \"iterations\": %d, \"total_ms\": %.3f, \"usec_per_iteration\": %.2f}",
+	    num_results++ ? "," : "", name, n, ns / 1e6, ns / 1e3 / n);
+    fflush(stdout);
+}
+
+
+static void skip_result(const char* name, const char* why)
+{
+    printf("%s\n    {\"name\": \"%s\", \"skipped\": \"%s\"}",
+	    num_results++ ? "," : "", name, why);
+    fflush(stdout);
+}
+
+
+/* Write the test images to a fresh directory, and add it to the */
+/* places the loaders look in.                                   */
+static int make_data_dir(void)
+{
+    char fn[PATH_LEN];
+    int i;
+
+#ifndef WIN32
+    strcpy(data_dir, "/tmp/t4k_benchXXXXXX");
+    if (!mkdtemp(data_dir))
+    {
+	data_dir[0] = '\0';
+	return 0;
+    }
+#else
+    strcpy(data_dir, "t4k_bench_data");
+    mkdir(data_dir);
+#endif
+    snprintf(images_dir, sizeof(images_dir), "%s/images", data_dir);
+#ifndef WIN32
+    if (mkdir(images_dir, S_IRWXU) != 0)
+#else
+    if (mkdir(images_dir) != 0)
+#endif
+	return 0;
+
+    for (i = 0; i < NUM_PNGS; i++)
+    {
+	snprintf(fn, PATH_LEN, "%s/bench%d.png", images_dir, i);
+	if (!write_png(fn, 256, 256, i))
+	    return 0;
+    }
+    snprintf(fn, PATH_LEN, "%s/bench.svg", images_dir);
+    if (!write_svg(fn))
+	return 0;
+
+    T4K_AddDataPrefix(data_dir);
+    return 1;
+}
+
+
+static void remove_data_dir(void)
+{
+    char fn[PATH_LEN];
+    int i;
+
+    if (!data_dir[0])
+	return;
+    for (i = 0; i < NUM_PNGS; i++)
+    {
+	snprintf(fn, PATH_LEN, "%s/bench%d.png", images_dir, i);
+	remove(fn);
+    }
+    snprintf(fn, PATH_LEN, "%s/bench.svg", images_dir);
+    remove(fn);
+    rmdir(images_dir);
+    rmdir(data_dir);
+}
+
+
+/* PNG files are written with "stored" (uncompressed) deflate blocks, */
+/* so no compression library is needed just for the test images.     */
+static Uint32 crc_table[256];
+
+static Uint32 crc32_update(Uint32 crc, const Uint8* p, int n)
+{
+    Uint32 c;
+    int i, k;
+
+    if (!crc_table[1])
+    {
+	for (i = 0; i < 256; i++)
+	{
+	    c = i;
+	    for (k = 0; k < 8; k++)
+		c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+	    crc_table[i] = c;
+	}
+    }
+    for (i = 0; i < n; i++)
+	crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void put32(Uint8* p, Uint32 x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+static void write_chunk(FILE* fp, const char* type, const Uint8* data, int n)
+{
+    Uint8 b[4];
+    Uint32 crc;
+
+    put32(b, n);
+    fwrite(b, 1, 4, fp);
+    fwrite(type, 1, 4, fp);
+    if (n)
+	fwrite(data, 1, n, fp);
+    crc = crc32_update(0xffffffff, (const Uint8*)type, 4);
+    crc = crc32_update(crc, data, n) ^ 0xffffffff;
+    put32(b, crc);
+    fwrite(b, 1, 4, fp);
+}
+
+/* A w x h RGBA gradient; w * 4 + 1 must fit in a stored block */
+static int write_png(const char* path, int w, int h, int seed)
+{
+    static const Uint8 sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    int row = w * 4 + 1, block = row + 5;
+    Uint8 hdr[13];
+    Uint8* z;
+    Uint8* p;
+    Uint32 a = 1, b = 0;
+    int x, y, i;
+    FILE* fp;
+
+    z = malloc(2 + h * block + 4);
+    if (!z)
+	return 0;
+
+    /* zlib header, then one stored block per row, then the Adler-32: */
+    z[0] = 0x78;
+    z[1] = 0x01;
+    p = z + 2;
+    for (y = 0; y < h; y++)
+    {
+	p[0] = y == h - 1;  // last block?
+	p[1] = row & 0xff;
+	p[2] = row >> 8;
+	p[3] = ~row & 0xff;
+	p[4] = (~row >> 8) & 0xff;
+	p[5] = 0;           // no filter
+	for (x = 0; x < w; x++)
+	{
+	    p[6 + x * 4] = x + seed * 16;
+	    p[7 + x * 4] = y;
+	    p[8 + x * 4] = x ^ y;
+	    p[9 + x * 4] = 0x80 + (x + y) / 4;
+	}
+	for (i = 5; i < block; i++)
+	{
+	    a = (a + p[i]) % 65521;
+	    b = (b + a) % 65521;
+	}
+	p += block;
+    }
+    put32(p, (b << 16) | a);
+
+    put32(hdr, w);
+    put32(hdr + 4, h);
+    hdr[8] = 8;     // bits per channel
+    hdr[9] = 6;     // RGBA
+    hdr[10] = hdr[11] = hdr[12] = 0;
+
+    fp = fopen(path, "wb");
+    if (!fp)
+    {
+	free(z);
+	return 0;
+    }
+    fwrite(sig, 1, 8, fp);
+    write_chunk(fp, "IHDR", hdr, 13);
+    write_chunk(fp, "IDAT", z, 2 + h * block + 4);
+    write_chunk(fp, "IEND", NULL, 0);
+    fclose(fp);
+    free(z);
+    return 1;
+}
+
+
+static int write_svg(const char* path)
+{
+    FILE* fp = fopen(path, "w");
+    int i;
+
+    if (!fp)
+	return 0;
+    fprintf(fp, "<?xml version=\"1.0\"?>\n"
+	    "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"256\" height=\"256\">\n");
+    for (i = 0; i < 40; i++)
+	fprintf(fp, "  <circle cx=\"%d\" cy=\"%d\" r=\"%d\" fill=\"#%06x\" fill-opacity=\"0.6\"/>\n",
+		(i * 37) % 256, (i * 91) % 256, 10 + i % 30, (i * 0x3579b) & 0xffffff);
+    fprintf(fp, "</svg>\n");
+    fclose(fp);
+    return 1;
+}
@@ -0,0 +1,344 @@
+/*
+   t4k_cache.c
+
+   Caches of scaled images and of button surfaces, so that loading or
+   zooming the same picture to the same size again (e.g. on every
+   resolution switch), or drawing the same button, only costs a lookup.
+
+   Copyright 2010.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+t4k_cache.c is part of the t4k_common library.
+
+t4k_common is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+t4k_common is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "t4k_common.h"
+#include "t4k_globals.h"
+#include "SDL.h"
+
+/* An entry is keyed by a file name (path), or by the surface it was  */
+/* scaled from (src), or by neither for a button, plus its size, mode */
+/* and color. The cache holds one reference on surf, and one on src,  */
+/* so src can't be freed and its address reused while it's cached.    */
+typedef struct cacheEntry
+{
+    char* path;
+    SDL_Surface* src;
+    int w, h, mode;
+    Uint32 color;
+    SDL_Surface* surf;
+    size_t bytes;
+    struct cacheEntry* next_hash;
+    struct cacheEntry* newer;   // LRU list, most recently used first
+    struct cacheEntry* older;
+} cacheEntry;
+
+#define CACHE_BUCKETS 256
+
+typedef struct surfCache
+{
+    const char* name;
+    cacheEntry* buckets[CACHE_BUCKETS];
+    cacheEntry* newest;
+    cacheEntry* oldest;
+    size_t bytes;
+    size_t budget;      // 0 - caching is off
+    unsigned long hits, misses;
+} surfCache;
+
+/* Scaled images are shared with the game, which might draw on them, */
+/* so that one is off until the game asks for it. Buttons are only   */
+/* shared by T4K_GetButton() users, which know not to.               */
+#define DEFAULT_BUTTON_CACHE (2 * 1024 * 1024)
+
+static surfCache scale_cache = {"scale_cache"};
+static surfCache button_cache = {"button_cache", {NULL}, NULL, NULL, 0, DEFAULT_BUTTON_CACHE};
+
+static SDL_Surface* cache_find(surfCache* c, const char* path, SDL_Surface* src,
+	int w, int h, int mode, Uint32 color);
+static void cache_add(surfCache* c, const char* path, SDL_Surface* src,
+	int w, int h, int mode, Uint32 color, SDL_Surface* surf);
+static unsigned int hash_key(const char* path, SDL_Surface* src, int w, int h, int mode, Uint32 color);
+static cacheEntry* find_entry(surfCache* c, const char* path, SDL_Surface* src,
+	int w, int h, int mode, Uint32 color);
+static void unlink_lru(surfCache* c, cacheEntry* e);
+static void push_lru(surfCache* c, cacheEntry* e);
+static void drop_entry(surfCache* c, cacheEntry* e);
+static void evict_to(surfCache* c, size_t budget);
+
+
+
+/* Sets the most memory (in bytes of pixel data) the scaled image  */
+/* cache may use, evicting the least recently used images if it is */
+/* now too big. 0 turns caching off and empties the cache.          */
+void T4K_SetScaleCacheSize(size_t bytes)
+{
+    scale_cache.budget = bytes;
+    evict_to(&scale_cache, bytes);
+    DEBUGMSG(debug_loaders, "T4K_SetScaleCacheSize(): budget %lu bytes\n",
+	    (unsigned long)bytes);
+}
+
+
+/* Same as T4K_zoomEx(), but the result is shared with any earlier  */
+/* call that had the same source surface, size and mode.            */
+SDL_Surface* T4K_zoomCached(SDL_Surface* src, int new_w, int new_h, int mode)
+{
+    SDL_Surface* s;
+
+    if (!src)
+	return NULL;
+
+    s = cache_find(&scale_cache, NULL, src, new_w, new_h, mode, 0);
+    if (s)
+	return s;
+
+    s = T4K_zoomEx(src, new_w, new_h, mode);
+    if (s)
+	cache_add(&scale_cache, NULL, src, new_w, new_h, mode, 0, s);
+    return s;
+}
+
+
+/* Same as T4K_CreateButton(), but the surface is shared with every */
+/* other caller asking for the same button, so it must not be drawn */
+/* on. Free it with SDL_FreeSurface() as usual.                     */
+SDL_Surface* T4K_GetButton(int w, int h, int radius,
+	Uint8 r, Uint8 g, Uint8 b, Uint8 a)
+{
+    SDL_Surface* s;
+    Uint32 color = ((Uint32)r << 24) | (g << 16) | (b << 8) | a;
+
+    s = cache_find(&button_cache, NULL, NULL, w, h, radius, color);
+    if (s)
+	return s;
+
+    s = T4K_CreateButton(w, h, radius, r, g, b, a);
+    if (s)
+	cache_add(&button_cache, NULL, NULL, w, h, radius, color, s);
+    return s;
+}
+
+
+/* Like T4K_SetScaleCacheSize(), for the button cache */
+void T4K_SetButtonCacheSize(size_t bytes)
+{
+    button_cache.budget = bytes;
+    evict_to(&button_cache, bytes);
+    DEBUGMSG(debug_sdl, "T4K_SetButtonCacheSize(): budget %lu bytes\n",
+	    (unsigned long)bytes);
+}
+
+
+/* Look up a cached image. On a hit, the caller gets its own        */
+/* reference, to be released with SDL_FreeSurface() as usual.       */
+SDL_Surface* scale_cache_find(const char* path, SDL_Surface* src, int w, int h, int mode)
+{
+    return cache_find(&scale_cache, path, src, w, h, mode, 0);
+}
+
+
+/* Remember surf as the result for this key. The caller keeps its  */
+/* own reference; the cache takes another one.                      */
+void scale_cache_add(const char* path, SDL_Surface* src, int w, int h, int mode, SDL_Surface* surf)
+{
+    cache_add(&scale_cache, path, src, w, h, mode, 0, surf);
+}
+
+
+/* Lookups that found something, and that didn't, in all the caches */
+void cache_stats(unsigned long* hits, unsigned long* misses)
+{
+    *hits = scale_cache.hits + button_cache.hits;
+    *misses = scale_cache.misses + button_cache.misses;
+}
+
+
+/* Empty the caches */
+void scale_cache_free(void)
+{
+    evict_to(&scale_cache, 0);
+    evict_to(&button_cache, 0);
+}
+
+
+
+static SDL_Surface* cache_find(surfCache* c, const char* path, SDL_Surface* src,
+	int w, int h, int mode, Uint32 color)
+{
+    cacheEntry* e;
+
+    if (!c->budget)
+	return NULL;
+
+    e = find_entry(c, path, src, w, h, mode, color);
+    if (!e)
+    {
+	c->misses++;
+	return NULL;
+    }
+
+    c->hits++;
+    unlink_lru(c, e);
+    push_lru(c, e);
+    e->surf->refcount++;
+    return e->surf;
+}
+
+
+static void cache_add(surfCache* c, const char* path, SDL_Surface* src,
+	int w, int h, int mode, Uint32 color, SDL_Surface* surf)
+{
+    cacheEntry* e;
+    unsigned int b;
+    size_t bytes;
+
+    if (!c->budget || !surf)
+	return;
+
+    bytes = (size_t)surf->pitch * surf->h;
+    if (bytes > c->budget)
+	return;
+    if (find_entry(c, path, src, w, h, mode, color))
+	return;
+
+    e = malloc(sizeof(cacheEntry));
+    if (!e)
+	return;
+    e->path = NULL;
+    if (path)
+    {
+	e->path = strdup(path);
+	if (!e->path)
+	{
+	    free(e);
+	    return;
+	}
+    }
+
+    e->src = src;
+    e->w = w;
+    e->h = h;
+    e->mode = mode;
+    e->color = color;
+    e->surf = surf;
+    e->bytes = bytes;
+    surf->refcount++;
+    if (src)
+	src->refcount++;
+
+    b = hash_key(path, src, w, h, mode, color);
+    e->next_hash = c->buckets[b];
+    c->buckets[b] = e;
+    push_lru(c, e);
+    c->bytes += bytes;
+
+    evict_to(c, c->budget);
+    DEBUGMSG(debug_loaders, "%s: added %s %dx%d, %lu bytes cached "
+	    "(%lu hits, %lu misses)\n", c->name, path ? path : "(surface)", w, h,
+	    (unsigned long)c->bytes, c->hits, c->misses);
+}
+
+
+static unsigned int hash_key(const char* path, SDL_Surface* src, int w, int h, int mode, Uint32 color)
+{
+    unsigned int x = 2166136261u;
+
+    if (path)
+	while (*path)
+	    x = (x ^ (unsigned char)*path++) * 16777619u;
+    else
+	x ^= (unsigned int)(size_t)src >> 4;
+    x = (x ^ (unsigned int)w) * 16777619u;
+    x = (x ^ (unsigned int)h) * 16777619u;
+    x = (x ^ (unsigned int)mode) * 16777619u;
+    x = (x ^ color) * 16777619u;
+    return x % CACHE_BUCKETS;
+}
+
+
+static cacheEntry* find_entry(surfCache* c, const char* path, SDL_Surface* src,
+	int w, int h, int mode, Uint32 color)
+{
+    cacheEntry* e;
+
+    for (e = c->buckets[hash_key(path, src, w, h, mode, color)]; e; e = e->next_hash)
+    {
+	if (e->w != w || e->h != h || e->mode != mode || e->color != color || e->src != src)
+	    continue;
+	if (path ? (e->path && !strcmp(e->path, path)) : !e->path)
+	    return e;
+    }
+    return NULL;
+}
+
+
+static void unlink_lru(surfCache* c, cacheEntry* e)
+{
+    if (e->newer)
+	e->newer->older = e->older;
+    else
+	c->newest = e->older;
+    if (e->older)
+	e->older->newer = e->newer;
+    else
+	c->oldest = e->newer;
+}
+
+
+static void push_lru(surfCache* c, cacheEntry* e)
+{
+    e->newer = NULL;
+    e->older = c->newest;
+    if (c->newest)
+	c->newest->newer = e;
+    else
+	c->oldest = e;
+    c->newest = e;
+}
+
+
+/* Take e out of the cache and release its references. Anyone else  */
+/* still holding the surface keeps it.                              */
+static void drop_entry(surfCache* c, cacheEntry* e)
+{
+    cacheEntry** p;
+
+    for (p = &c->buckets[hash_key(e->path, e->src, e->w, e->h, e->mode, e->color)];
+	    *p; p = &(*p)->next_hash)
+    {
+	if (*p == e)
+	{
+	    *p = e->next_hash;
+	    break;
+	}
+    }
+    unlink_lru(c, e);
+    c->bytes -= e->bytes;
+
+    SDL_FreeSurface(e->surf);
+    if (e->src)
+	SDL_FreeSurface(e->src);
+    free(e->path);
+    free(e);
+}
+
+
+static void evict_to(surfCache* c, size_t budget)
+{
+    while (c->oldest && (c->bytes > budget || !budget))
+	drop_entry(c, c->oldest);
+}
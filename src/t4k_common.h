@@ -203,10 +203,52 @@ typedef enum
     WIPE_BLINDS_HORIZ,
     WIPE_BLINDS_BOX,
     RANDOM_WIPE,
+    /* (added later, after RANDOM_WIPE, to keep its value) */
+    WIPE_CROSSFADE,     //!< needs a 32 bit screen, else dissolves
+    WIPE_DISSOLVE,
+    WIPE_SLIDE_LEFT,
+    WIPE_SLIDE_UP,
     NUM_WIPES
 }
 WipeStyle;
 
+//==============================================================================
+//!
+//! \enum
+//!     T4K_ZoomMode
+//!
+//! \brief
+//!     Filters for T4K_zoomEx().
+//!
+typedef enum
+{
+    T4K_ZOOM_BILINEAR,  //!< What T4K_zoom() does: fast, but shrinking by more than half skips pixels and aliases.
+    T4K_ZOOM_AREA,      //!< Averages every source pixel under each new one when shrinking; bilinear when enlarging.
+    T4K_NUM_ZOOM_MODES
+}
+T4K_ZoomMode;
+
+//==============================================================================
+//!
+//! \enum
+//!     T4K_Layer
+//!
+//! \brief
+//!     Blit queue layers, listed from bottom to top. T4K_UpdateScreen()
+//!     draws each layer's queue in this order, so objects on a higher
+//!     layer always end up on top of those on a lower one.
+//!
+typedef enum
+{
+    T4K_LAYER_BACKGROUND,
+    T4K_LAYER_SPRITES,   //!< used by T4K_DrawObject() and friends
+    T4K_LAYER_HUD,
+    T4K_LAYER_OVERLAY,
+    T4K_LAYER_PERF,      //!< used by the performance HUD (F12)
+    T4K_NUM_LAYERS
+}
+T4K_Layer;
+
 //==============================================================================
 //!
 //! Special values used by RunMenu.
@@ -237,7 +279,8 @@ MFStrategy;
 #define IMG_REGULAR         0x01
 #define IMG_COLORKEY        0x02
 #define IMG_ALPHA           0x04
-#define IMG_MODES           0x07
+#define IMG_PREMULTIPLIED   0x08 //!< Like IMG_ALPHA, premultiplied for T4K_BlitPremultiplied()
+#define IMG_MODES           0x0f
 
 #define IMG_NOT_REQUIRED    0x10
 #define IMG_NO_PNG_FALLBACK 0x20
@@ -320,7 +363,8 @@ void CleanupT4KCommon( void );
 //
 //! \brief
 //!     Handle events that should have consistent effects everywhere 
-//!     in the program.
+//!     in the program: F10 toggles fullscreen, F11 toggles music and
+//!     F12 toggles the performance HUD.
 //! 
 //! \param 
 //!     event      - the event to check
@@ -638,9 +682,8 @@ void T4K_DrawButton( SDL_Rect* target_rect,
 //!     the given surface.
 //!     All colors and alpha values are supported.
 //!
-//!     This function creates a temporary surface to blit onto target.
-//!     If performance is an issue, consider using T4K_CreateButton 
-//!     to save the surface.
+//!     The button is drawn straight onto target with
+//!     T4K_FillRoundedRect, without making a button surface first.
 //!
 //! \param
 //!     target        - The SDL_Surface to draw on
@@ -706,6 +749,59 @@ SDL_Surface* T4K_CreateButton( int    w,
                                Uint8  a 
                               );
 
+//==============================================================================
+//
+//  T4K_GetButton
+//
+//! \brief
+//!     Like T4K_CreateButton, but the button is kept in a cache and shared
+//!     with everyone else asking for the same size, radius and color, so
+//!     it must not be drawn on. Least recently used buttons are dropped
+//!     once the cache is full (see T4K_SetButtonCacheSize).
+//!
+//! \param
+//!     w        - The width of the button
+//! \param
+//!     h        - The height of the button
+//! \param
+//!     radius   - The radius of the arcs on each corner.
+//! \param
+//!     r        - R component of the button's color
+//! \param
+//!     g        - G component of the button's color
+//! \param
+//!     b        - B component of the button's color
+//! \param
+//!     a        - The opacity of the button
+//!
+//! \return
+//!     The button surface, to be released with SDL_FreeSurface as usual.
+//!
+SDL_Surface* T4K_GetButton( int    w,
+                            int    h,
+                            int    radius,
+                            Uint8  r,
+                            Uint8  g,
+                            Uint8  b,
+                            Uint8  a
+                          );
+
+//==============================================================================
+//
+//  T4K_SetButtonCacheSize
+//
+//! \brief
+//!     Set how much pixel data the T4K_GetButton cache may hold
+//!     (2 MB by default). 0 turns the cache off and empties it.
+//!
+//! \param
+//!     bytes    - The cache budget in bytes.
+//!
+//! \return
+//!     None
+//!
+void T4K_SetButtonCacheSize( size_t bytes );
+
 //==============================================================================
 //
 //  T4K_RoundCorners
@@ -726,12 +822,51 @@ void T4K_RoundCorners( SDL_Surface* s,
                        Uint16       radius
                      );
 
+//==============================================================================
+//
+//  T4K_FillRoundedRect
+//
+//! \brief
+//!     Fill a rounded rectangle on a surface with a translucent color,
+//!     a scanline at a time, with anti-aliased corners. The result looks
+//!     like blitting a T4K_CreateButton surface there, but nothing is
+//!     allocated. Drawing is clipped to target's clip rect, and target's
+//!     own alpha channel (if any) is left as it was.
+//!
+//! \param
+//!     target   - The surface to draw on
+//! \param
+//!     rect     - The bounding rectangle of the button
+//! \param
+//!     radius   - The radius of the arcs on each corner
+//! \param
+//!     r        - R component of the color
+//! \param
+//!     g        - G component of the color
+//! \param
+//!     b        - B component of the color
+//! \param
+//!     a        - The opacity of the color
+//!
+//! \return
+//!     None
+//!
+void T4K_FillRoundedRect( SDL_Surface* target,
+                          SDL_Rect*    rect,
+                          int          radius,
+                          Uint8        r,
+                          Uint8        g,
+                          Uint8        b,
+                          Uint8        a
+                        );
+
 //==============================================================================
 //
 //  T4K_Flip
 //
 //! \brief
-//!     Flip a surface vertically or horizontally.
+//!     Flip a surface vertically, horizontally, or both. The copy is in
+//!     the same format as the original, with the same colorkey and alpha.
 //! 
 //! \param
 //!     in        - The source surface
@@ -757,9 +892,10 @@ SDL_Surface* T4K_Flip( SDL_Surface* in,
 //!     1.0, and represents the weight assigned to the first surface.  If
 //!     the pointer to the second surface is NULL, this performs fading.
 //!
-//!     Currently this works only with RGBA images, but this is largely to
-//!     make the (fast) pointer arithmetic work out; it could be easily
-//!     generalized to other image types.
+//!     Currently this works only with 32 bit images. When both are in the
+//!     same format it uses fixed-point math (with SSE2/AVX2 where the CPU
+//!     has them), so each channel may be off by one from the exact blend.
+//!     The images are aligned at the bottom if their heights differ.
 //! 
 //! \param
 //!     S1       - The first surface
@@ -778,6 +914,115 @@ SDL_Surface* T4K_Blend( SDL_Surface* S1,
                         float        gamma
                       );
 
+//==============================================================================
+//
+//  T4K_BlendInto
+//
+//! \brief
+//!     Like T4K_Blend, but writes into a surface the caller already has
+//!     (the screen, say) instead of allocating a new one, and only within
+//!     a rect, so a crossfade or fade-out needs no allocations per frame.
+//!     S1 and S2 are read at the same coordinates they are written to in
+//!     dst, and dst may be S1 itself. If dst has no alpha channel, fading
+//!     (S2 NULL) darkens S1 towards black instead. The screen is not
+//!     updated; call SDL_UpdateRect on the rect afterwards.
+//!
+//! \param
+//!     dst      - The surface to write to
+//! \param
+//!     S1       - The first surface
+//! \param
+//!     S2       - The second surface, or NULL to fade S1
+//! \param
+//!    gamma    - A value between 0.0 and 1.0, representing the weight
+//!                assigned to the first surface.
+//! \param
+//!     r        - The part of dst to write, or NULL for all of it
+//!
+//! \return
+//!    1 on success (even if r misses dst), 0 on a bad argument.
+//!
+int T4K_BlendInto( SDL_Surface* dst,
+                   SDL_Surface* S1,
+                   SDL_Surface* S2,
+                   float        gamma,
+                   SDL_Rect*    r
+                 );
+
+//==============================================================================
+//
+//  T4K_PremultiplyAlpha
+//
+//! \brief
+//!     Multiply the colors of a surface with an alpha channel by its
+//!     alpha, in place, and mark it as premultiplied. From then on the
+//!     blit queue (T4K_DrawObject and friends) composites it with one
+//!     multiply-add per channel instead of SDL's alpha blitter. Images
+//!     loaded with IMG_PREMULTIPLIED have already been through this.
+//!     T4K_Flip, T4K_zoom, T4K_zoomEx, T4K_zoomCached and the sprite
+//!     functions built on them keep the mark on what they make from such
+//!     a surface; other copies (SDL_DisplayFormat, say) lose it.
+//!     Don't draw such a surface with SDL_BlitSurface, which would apply
+//!     its alpha a second time; use T4K_BlitPremultiplied instead.
+//!     The library keeps a reference on every marked surface, and lets
+//!     go of it once the game has freed it: at the next T4K_UpdateScreen,
+//!     when the number of marked surfaces has doubled, or at the latest
+//!     in CleanupT4KCommon.
+//!
+//! \param
+//!     s           - The surface to convert
+//!
+//! \return
+//!     1 on success (or if s already was premultiplied), 0 if s is NULL,
+//!     has no alpha channel or can't be locked.
+//!
+int T4K_PremultiplyAlpha( SDL_Surface* s );
+
+//==============================================================================
+//
+//  T4K_IsPremultiplied
+//
+//! \brief
+//!     Whether a surface is marked as premultiplied (see
+//!     T4K_PremultiplyAlpha).
+//!
+//! \param
+//!     s           - The surface
+//!
+//! \return
+//!     1 if it is, 0 if not (or s is NULL).
+//!
+int T4K_IsPremultiplied( SDL_Surface* s );
+
+//==============================================================================
+//
+//  T4K_BlitPremultiplied
+//
+//! \brief
+//!     SDL_BlitSurface for surfaces from T4K_PremultiplyAlpha: every channel
+//!     of dst becomes src + dst * (1 - src alpha). Clipping, and the NULL
+//!     rects, work as for SDL_BlitSurface, and dstrect is set to the part
+//!     of dst that was drawn.
+//!
+//! \param
+//!     src         - The premultiplied surface
+//! \param
+//!     srcrect     - The part of src to draw, or NULL for all of it
+//! \param
+//!     dst         - The surface to draw on, usually the screen
+//! \param
+//!     dstrect     - Where to draw it (only x and y are used), or NULL
+//!                   for the top left corner
+//!
+//! \return
+//!     1 on success (even if nothing was drawn), 0 on a bad argument.
+//!
+int T4K_BlitPremultiplied( SDL_Surface* src,
+                           SDL_Rect*    srcrect,
+                           SDL_Surface* dst,
+                           SDL_Rect*    dstrect
+                         );
+
 //==============================================================================
 //
 //  T4K_FreeSurfaceArray
@@ -878,6 +1123,30 @@ void T4K_UpdateRect( SDL_Surface* surf,
 //!
 void T4K_DarkenScreen( Uint8 bits );
 
+//==============================================================================
+//
+//  T4K_DarkenRects
+//
+//! \brief
+//!     Darkens parts of the screen by a factor of 2^bits, e.g. behind a
+//!     pause box, and queues them to be updated by the next
+//!     T4K_UpdateScreen, so there is no need to flip the whole screen.
+//!
+//! \param
+//!     rects      - The rects to darken; they are clipped to the screen.
+//! \param
+//!     n          - How many rects there are.
+//! \param
+//!     bits       - An exponent between 1 and 8, as for T4K_DarkenScreen.
+//!
+//! \return
+//!     None
+//!
+void T4K_DarkenRects( SDL_Rect* rects,
+                      int       n,
+                      Uint8     bits
+                    );
+
 //==============================================================================
 //
 //  T4K_ChangeWindowSize
@@ -975,12 +1244,133 @@ SDL_Surface* T4K_zoom( SDL_Surface* src,
                        int          new_h
                      );
 
+//==============================================================================
+//
+//  T4K_zoomEx
+//
+//! \brief 
+//!     Scale an existing surface with a choice of filter. T4K_ZOOM_AREA
+//!     gives much smoother results than T4K_zoom when shrinking big
+//!     artwork to icon size, at some cost in speed. It needs a 32 bit
+//!     surface; other depths are always scaled by T4K_zoom.
+//! 
+//! \param
+//!     src         - The original surface, which is left unscathed.
+//! \param 
+//!     new_w       - The width of the new surface.
+//! \param 
+//!     new_h       - The height of the new surface.
+//! \param 
+//!     mode        - A T4K_ZoomMode.
+//!
+//! \return 
+//!     Will return a newly allocated SDL_Surface.
+//!
+SDL_Surface* T4K_zoomEx( SDL_Surface* src,
+                         int          new_w,
+                         int          new_h,
+                         int          mode
+                       );
+
+//==============================================================================
+//
+//  T4K_SetScaleThreads
+//
+//! \brief 
+//!     Let T4K_zoom (and so the image loaders) scale 32 bit surfaces on
+//!     several threads, each doing a band of output rows. The result is
+//!     exactly the same as with one thread. Small surfaces are always
+//!     scaled on one thread. This is off by default.
+//! 
+//! \param
+//!     n           - The number of threads to use. 0 or 1 turns threading
+//!                   off; a negative value uses one thread per CPU.
+//!
+//! \return 
+//!     None
+//!
+void T4K_SetScaleThreads( int n );
+
+//==============================================================================
+//
+//  T4K_SetReferenceKernels
+//
+//! \brief
+//!     Make T4K_zoom, T4K_Blend, T4K_BlendInto, T4K_Flip, T4K_DarkenScreen,
+//!     T4K_DarkenRects, T4K_FillRoundedRect and T4K_BlitPremultiplied
+//!     skip their fast 32 bit paths and use the plain generic code
+//!     instead. This is meant for testing the fast paths against the
+//!     original code; games have no reason to turn it on.
+//!
+//! \param
+//!     on          - Nonzero for the generic code, 0 (the default) for
+//!                   the fast paths.
+//!
+//! \return
+//!     None
+//!
+void T4K_SetReferenceKernels( int on );
+
+//==============================================================================
+//
+//  T4K_zoomCached
+//
+//! \brief
+//!     Like T4K_zoomEx, but the result is kept in the scaled image cache
+//!     (see T4K_SetScaleCacheSize), so scaling the same surface to the
+//!     same size again just returns the same surface with its refcount
+//!     raised. The cache keeps a reference to src, so src must not be
+//!     drawn on afterwards, and the result must be treated as read-only.
+//!     With the cache off this is just T4K_zoomEx.
+//!
+//! \param
+//!     src         - The original surface, which is left unscathed.
+//! \param
+//!     new_w       - The width of the new surface.
+//! \param
+//!     new_h       - The height of the new surface.
+//! \param
+//!     mode        - A T4K_ZoomMode.
+//!
+//! \return
+//!     A surface to be released with SDL_FreeSurface as usual.
+//!
+SDL_Surface* T4K_zoomCached( SDL_Surface* src,
+                             int          new_w,
+                             int          new_h,
+                             int          mode
+                           );
+
+//==============================================================================
+//
+//  T4K_SetScaleCacheSize
+//
+//! \brief
+//!     Turn on the scaled image cache, which T4K_LoadImage,
+//!     T4K_LoadScaledImage, T4K_LoadImageOfBoundingBox (and so the sprite
+//!     loaders) and T4K_zoomCached share. Loading the same file at the
+//!     same size and mode again then returns the surface already loaded,
+//!     so those surfaces must be treated as read-only. When the cache
+//!     grows past its budget, the least recently used images are dropped
+//!     from it (callers still holding them keep them). Off by default.
+//!
+//! \param
+//!     bytes       - The most pixel data to keep cached. 0 turns the cache
+//!                   off and empties it.
+//!
+//! \return
+//!     None
+//!
+void T4K_SetScaleCacheSize( size_t bytes );
+
 //==============================================================================
 // 
 //  T4K_TransWipe
 //
 //! \brief 
-//!     Perform a wipe from the current screen image to a new one.
+//!     Perform a wipe from the current screen image to a new one, and
+//!     don't return until it is done. See T4K_TransWipeStart for a wipe
+//!     that runs alongside the game loop.
 //! 
 //! \param 
 //!     newbkg       - The new image to wipe.
@@ -989,7 +1379,8 @@ SDL_Surface* T4K_zoom( SDL_Surface* src,
 //! \param 
 //!     segments     - The number of division of the screen.
 //! \param 
-//!     duration     - The length of the animation in milliseconds.
+//!     duration     - The length of the animation in frames of about
+//!                    20 milliseconds.
 //! 
 //! \return
 //!     Return 0 if newbkg is NULL and new background surface width and height
@@ -1001,6 +1392,69 @@ int T4K_TransWipe( const SDL_Surface* newbkg,
                    int                duration
                  );
 
+//==============================================================================
+// 
+//  T4K_TransWipeStart
+//
+//! \brief 
+//!     Start a wipe from the current screen image to a new one. Nothing is
+//!     drawn until T4K_TransWipeStep is called. Starting a wipe while
+//!     another is running finishes the old one first.
+//! 
+//! \param 
+//!     newbkg       - The new image to wipe. A reference is kept until the
+//!                    wipe is over, so the caller may free it at once.
+//! \param 
+//!     type         - The WipeStyle to use.
+//! \param 
+//!     segments     - The number of division of the screen.
+//! \param 
+//!     duration     - The length of the animation in milliseconds.
+//! 
+//! \return
+//!     0 if newbkg is NULL or not the size of the screen, otherwise 1.
+//!
+int T4K_TransWipeStart( const SDL_Surface* newbkg,
+                        WipeStyle          type,
+                        int                segments,
+                        int                duration
+                      );
+
+//==============================================================================
+// 
+//  T4K_TransWipeStep
+//
+//! \brief 
+//!     Carry the running wipe on as far as the time since it started calls
+//!     for. Only the newly uncovered strips are drawn, and they are queued
+//!     with T4K_AddRect, so call this once a frame before T4K_UpdateScreen.
+//!     Once the time is up, the wipe is finished as by T4K_TransWipeFinish.
+//! 
+//! \param 
+//!     None
+//! 
+//! \return
+//!     1 if the wipe is still running, 0 once it is over (or if none was
+//!     started).
+//!
+int T4K_TransWipeStep( void );
+
+//==============================================================================
+// 
+//  T4K_TransWipeFinish
+//
+//! \brief 
+//!     End the running wipe at once, drawing all of the new image and
+//!     queuing the whole screen for the next T4K_UpdateScreen.
+//! 
+//! \param 
+//!     None
+//! 
+//! \return
+//!     None
+//!
+void T4K_TransWipeFinish( void );
+
 //==============================================================================
 // 
 //  T4K_InitBlitQueue
@@ -1124,20 +1578,75 @@ void T4K_UpdateScreen( int* frame );
 
 //==============================================================================
 //
-//  T4K_EraseSprite
+//  T4K_SetFullUpdateFraction
 //
 //! \brief
-//!     Basically puts in an order to overdraw sprite 
-//!     with corresponding rect of bkgd img.
+//!     T4K_UpdateScreen merges overlapping and adjacent update rects before
+//!     pushing them to the display. If the merged area is larger than this
+//!     fraction of the screen, a single full-screen update is done instead.
 //! 
 //! \param
-//!     img        - Sprite to delete.
-//! \param
-//!     curr_bkgd  - Surface of the background.
-//! \param
-//!     x          - x coordinate
-//! \param
-//!     y          - y coordinate
+//!     fraction     - A value between 0.0 (always update the whole screen)
+//!                    and 1.0 (never). The default is 0.5.
+//!
+//! \return
+//!     None
+//!
+void T4K_SetFullUpdateFraction( float fraction );
+
+//==============================================================================
+//
+//  T4K_SetBlitThreads
+//
+//! \brief
+//!     Let T4K_UpdateScreen split the screen into horizontal bands and do
+//!     the queued erases and draws on several threads at once. This is
+//!     off by default, and is only used on frames that blit at least
+//!     T4K_SetBlitThreadArea() pixels to a software screen surface.
+//! 
+//! \param
+//!     n            - The number of threads to use. 0 or 1 turns threading
+//!                    off; a negative value uses one thread per CPU.
+//!
+//! \return
+//!     None
+//!
+void T4K_SetBlitThreads( int n );
+
+//==============================================================================
+//
+//  T4K_SetBlitThreadArea
+//
+//! \brief
+//!     Frames that blit fewer pixels than this are done on a single thread
+//!     even if T4K_SetBlitThreads has been called, since for small updates
+//!     handing work to other threads costs more than it saves.
+//! 
+//! \param
+//!     pixels       - The smallest total blit area worth threading. The
+//!                    default is 65536 (256x256).
+//!
+//! \return
+//!     None
+//!
+void T4K_SetBlitThreadArea( int pixels );
+
+//==============================================================================
+//
+//  T4K_EraseSprite
+//
+//! \brief
+//!     Basically puts in an order to overdraw sprite 
+//!     with corresponding rect of bkgd img.
+//! 
+//! \param
+//!     img        - Sprite to delete.
+//! \param
+//!     curr_bkgd  - Surface of the background.
+//! \param
+//!     x          - x coordinate
+//! \param
+//!     y          - y coordinate
 //! 
 //! \return
 //!     1          - Successful erase of the spriate.
@@ -1177,6 +1686,186 @@ int T4K_EraseObject( SDL_Surface* surf,
                      int          y
                    );
 
+//==============================================================================
+//
+//  T4K_AddRectOnLayer
+//
+//! \brief
+//!     Like T4K_AddRect, but the rect is queued on the given layer.
+//!
+//! \param
+//!    src        - The source dimension of the screen.  
+//! \param 
+//!    dst        - The destination dimension of the screen.
+//! \param
+//!    layer      - The T4K_Layer to queue the rect on.
+//!
+//! \return
+//!    1          - Add SDL_Rect successful.
+//! \return
+//!    0          - If invalid parameter and add SDL_Rect failed. 
+//!
+int T4K_AddRectOnLayer( SDL_Rect* src,
+                        SDL_Rect* dst,
+                        int       layer
+                      );
+
+//==============================================================================
+//
+//  T4K_DrawSpriteOnLayer
+//
+//! \brief
+//!     Like T4K_DrawSprite, but the sprite is drawn on the given layer.
+//!
+//! \param 
+//!     gfx        - Holds the sprite object.
+//! \param 
+//!     x          - The x position to draw the sprite. 
+//! \param 
+//!     y          - The y position to draw the sprite. 
+//! \param
+//!     layer      - The T4K_Layer to draw the sprite on.
+//! 
+//! \return
+//!     1          - Successful draw of the sprite.
+//! \return
+//!     0          - Failed to draw the sprite.
+//!
+int T4K_DrawSpriteOnLayer( sprite* gfx,
+                           int     x,
+                           int     y,
+                           int     layer
+                         );
+
+//==============================================================================
+//
+//  T4K_DrawObjectOnLayer
+//
+//! \brief
+//!     Like T4K_DrawObject, but the object is drawn on the given layer.
+//!
+//! \param
+//!     surf        - Holds the surface to draw.
+//! \param
+//!     x           - The x position to draw the object. 
+//! \param
+//!     y           - The y position to draw the object. 
+//! \param
+//!     layer       - The T4K_Layer to draw the object on.
+//! 
+//! \return
+//!     1           - Successful draw of the object.
+//! \return
+//!     0           - Failed to draw the object.
+//!
+int T4K_DrawObjectOnLayer( SDL_Surface* surf,
+                           int          x,
+                           int          y,
+                           int          layer
+                         );
+
+//==============================================================================
+//
+//  T4K_EraseSpriteOnLayer
+//
+//! \brief
+//!     Like T4K_EraseSprite, but the erase is queued on the given layer.
+//! 
+//! \param
+//!     img        - Sprite to delete.
+//! \param
+//!     curr_bkgd  - Surface of the background.
+//! \param
+//!     x          - x coordinate
+//! \param
+//!     y          - y coordinate
+//! \param
+//!     layer      - The T4K_Layer the sprite was drawn on.
+//! 
+//! \return
+//!     1          - Successful erase of the sprite.
+//! \return
+//!     0          - Failed to erase the sprite.
+//!
+int T4K_EraseSpriteOnLayer( sprite*      img,
+                            SDL_Surface* curr_bkgd,
+                            int          x,
+                            int          y,
+                            int          layer
+                          );
+
+//==============================================================================
+//
+//  T4K_EraseObjectOnLayer
+//
+//! \brief
+//!     Like T4K_EraseObject, but the erase is queued on the given layer.
+//!     Erases from every layer are done before anything is drawn.
+//! 
+//! \param
+//!     surf        - Surface to delete
+//! \param
+//!     curr_bkgd   - Current background
+//! \param
+//!     x           - x coordinate
+//! \param
+//!     y           - y coordinate
+//! \param
+//!     layer       - The T4K_Layer the object was drawn on.
+//! 
+//! \return
+//!     1           - Successful operation
+//! \return
+//!     0           - Failed operation 
+//!
+int T4K_EraseObjectOnLayer( SDL_Surface* surf,
+                            SDL_Surface* curr_bkgd,
+                            int          x,
+                            int          y,
+                            int          layer
+                          );
+
+//==============================================================================
+//
+//  T4K_SetLayerRetained
+//
+//! \brief
+//!     A retained layer keeps its queued draws from one frame to the next,
+//!     so static content such as a HUD only needs to be queued once. On
+//!     later frames T4K_UpdateScreen redraws it only where something
+//!     beneath it was erased or drawn, and skips it entirely otherwise.
+//!     Layers are not retained by default.
+//! 
+//! \param
+//!     layer       - The T4K_Layer to change.
+//! \param
+//!     retained    - Nonzero to retain the layer, zero to go back to
+//!                   flushing it every frame.
+//!
+//! \return
+//!     None
+//!
+void T4K_SetLayerRetained( int layer,
+                           int retained
+                         );
+
+//==============================================================================
+//
+//  T4K_ClearLayer
+//
+//! \brief
+//!     Drop everything queued on a layer, including the draws a retained
+//!     layer has been keeping. This does not touch the screen - erase the
+//!     old content as usual before queuing new draws.
+//! 
+//! \param
+//!     layer       - The T4K_Layer to clear.
+//!
+//! \return
+//!     None
+//!
+void T4K_ClearLayer( int layer );
+
 //==============================================================================
 // 
 //  T4K_SetFontName
@@ -1594,7 +2283,9 @@ sprite* T4K_LoadSpriteOfBoundingBox( const char* name,
 //  T4K_FlipSprite
 // 
 //! \brief
-//!     Flip (reflect) a sprite over one or both axes.
+//!     Flip (reflect) a sprite over one or both axes. The flipped frames
+//!     are kept on the original sprite and shared with the new one, so
+//!     flipping the same sprite the same way again costs no copying.
 //! 
 //! \param
 //!     in        - The original image
@@ -1614,6 +2305,60 @@ sprite* T4K_FlipSprite( sprite* in,
                         int     Y 
                       );
 
+//==============================================================================
+//
+//  T4K_GetFlippedFrame
+//
+//! \brief
+//!     Get one frame of a sprite flipped, without flipping the others.
+//!     It is made on first use and kept on the sprite, so a game can draw
+//!     a sprite facing either way and only pay for the frames it shows.
+//!
+//! \param
+//!     s         - The sprite
+//! \param
+//!     frame     - The frame number, or -1 for the default image
+//! \param
+//!     X         - If nonzero, the image is flipped horizontally.
+//! \param
+//!     Y         - If nonzero, the image is flipped vertically.
+//!
+//! \return
+//!     The flipped frame, which belongs to the sprite (do not free it),
+//!     or NULL if there is no such frame or we ran out of memory.
+//!
+SDL_Surface* T4K_GetFlippedFrame( sprite* s,
+                                  int     frame,
+                                  int     X,
+                                  int     Y
+                                );
+
+//==============================================================================
+//
+//  T4K_ScaleSprite
+// 
+//! \brief
+//!     Make a copy of a sprite at a new size, with area averaging. The
+//!     first call builds a chain of half-size copies of each frame and
+//!     keeps it on the original sprite (about a third more memory), so
+//!     later calls only have to shrink the nearest of those by less than
+//!     half, however small the requested size.
+//! 
+//! \param
+//!     in        - The original sprite
+//! \param 
+//!     w         - The width of the new frames.
+//! \param
+//!     h         - The height of the new frames.
+//! 
+//! \return
+//!     A newly allocated sprite, to be freed with T4K_FreeSprite.
+//!
+sprite* T4K_ScaleSprite( sprite* in,
+                         int     w,
+                         int     h
+                       );
+
 //==============================================================================
 //
 //  T4K_FreeSprite
@@ -1953,9 +2698,10 @@ void T4K_LineWrapList( const char input[MAX_LINES][MAX_LINEWIDTH],
 //
 //! /brief
 //!     Use this simple function to keep a loop from eating all CPU.
-//!     Here we use SDL_Delay() to wait to return until 'loop_msec'
-//!     milliseconds after it returned the last time. Per SDL docs,
-//!     the granularity is likely no better than 10 msec
+//!     It waits to return until 'loop_msec' milliseconds after it
+//!     returned the last time, sleeping most of the way and spinning
+//!     for the last half millisecond. Loops that need a steady frame
+//!     rate should use a T4K_FrameScheduler instead.
 //!
 //! /param
 //!     loop_msec     - The desired loop duration, in msec
@@ -1970,6 +2716,230 @@ void T4K_Throttle( int     loop_msec,
                    Uint32* last_t
                  );
 
+//==============================================================================
+//!
+//! \struct
+//!     T4K_FrameScheduler
+//!
+//! \brief
+//!     Keeps a game loop to a steady frame rate, optionally with game
+//!     logic updated at a fixed rate of its own. All times are in
+//!     nanoseconds of T4K_GetTimeNS. A loop using one looks like:
+//!
+//!     <code>
+//!     T4K_InitFrameScheduler(&fs, 60, 30);
+//!     while (playing)
+//!     {
+//!         for (n = T4K_FrameUpdates(&fs); n > 0; n--)
+//!             update_game();
+//!         draw_game(T4K_FrameAlpha(&fs));
+//!         T4K_FrameWait(&fs);
+//!     }
+//!     </code>
+//!
+typedef struct
+{
+    Uint64 frame_ns;         /**< Target length of a frame */
+    Uint64 step_ns;          /**< Length of a fixed update, 0 if not used */
+    Uint64 next_ns;          /**< When the current frame should end */
+    Uint64 last_ns;          /**< Time of the last T4K_FrameUpdates */
+    Uint64 accum_ns;         /**< Time not yet used up by fixed updates */
+    Uint64 late_ns;          /**< How late the last overrun frame ended */
+    unsigned long frames;    /**< Frames so far */
+    unsigned long overruns;  /**< Frames that ended after their deadline */
+}
+T4K_FrameScheduler;
+
+//=============================================================================
+//
+//  T4K_GetTimeNS
+//
+//! /brief
+//!     The time in nanoseconds from a monotonic clock (clock_gettime()
+//!     where there is one, else SDL_GetTicks()), from an arbitrary start.
+//!
+//! /return
+//!     The time in nanoseconds
+//!
+Uint64 T4K_GetTimeNS( void );
+
+//=============================================================================
+//
+//  T4K_InitFrameScheduler
+//
+//! /brief
+//!     Set up a frame scheduler, with its first frame starting now.
+//!
+//! /param
+//!     fs               - The scheduler to set up
+//! /param
+//!     frames_per_sec   - The frame rate to keep to
+//! /param
+//!     updates_per_sec  - The rate of fixed updates, or 0 for one update
+//!                        per frame
+//!
+//! /return
+//!     None
+//!
+void T4K_InitFrameScheduler( T4K_FrameScheduler* fs,
+                             int                 frames_per_sec,
+                             int                 updates_per_sec
+                           );
+
+//=============================================================================
+//
+//  T4K_FrameUpdates
+//
+//! /brief
+//!     Call once a frame to find how many fixed updates to run for the
+//!     time since the last call. Time left over carries over to the next
+//!     frame. At most 5 are asked for at once; if the game falls further
+//!     behind than that, the rest of the time is dropped.
+//!
+//! /param
+//!     fs            - The scheduler
+//!
+//! /return
+//!     The number of updates to run (always 1 without fixed updates)
+//!
+int T4K_FrameUpdates( T4K_FrameScheduler* fs );
+
+//=============================================================================
+//
+//  T4K_FrameAlpha
+//
+//! /brief
+//!     How far the time is between the last fixed update and the next,
+//!     for drawing moving things part way along.
+//!
+//! /param
+//!     fs            - The scheduler
+//!
+//! /return
+//!     A value from 0.0 to 1.0 (always 1.0 without fixed updates)
+//!
+float T4K_FrameAlpha( T4K_FrameScheduler* fs );
+
+//=============================================================================
+//
+//  T4K_FrameWait
+//
+//! /brief
+//!     Wait for the end of the current frame, sleeping most of the way and
+//!     spinning for the last half millisecond. Frame deadlines are fixed
+//!     from the start, so the frame rate doesn't drift. If the frame has
+//!     already overrun it returns at once, and if it is over a frame late
+//!     the schedule starts over from now.
+//!
+//! /param
+//!     fs            - The scheduler
+//!
+//! /return
+//!     1 if the frame overran its deadline, otherwise 0
+//!
+int T4K_FrameWait( T4K_FrameScheduler* fs );
+
+
+//=============================================================================
+//                      Public Definitions for t4k_framestats.c
+//=============================================================================
+
+#define T4K_FRAME_HIST_BUCKETS 32   //!< Buckets in T4K_FrameStats.histogram
+#define T4K_FRAME_HIST_MS 2         //!< Frame time covered by each bucket
+
+//==============================================================================
+//!
+//! \struct
+//!     T4K_FrameStats
+//!
+//! \brief
+//!     A summary of recent frames, from T4K_GetFrameStats. Times are in
+//!     milliseconds, as the 50th, 95th and 99th percentiles.
+//!
+typedef struct
+{
+    int frames;          /**< How many frames this covers */
+    float frame_ms[3];   /**< Time from one T4K_UpdateScreen to the next */
+    float cpu_ms[3];     /**< Time the main thread was busy in a frame */
+    float blits;         /**< Average blits per frame */
+    float pixels;        /**< Average pixels blitted per frame */
+    float update_area;   /**< Average pixels sent to the display per frame */
+    int overruns;        /**< Frames T4K_FrameWait found late */
+    int histogram[T4K_FRAME_HIST_BUCKETS]; /**< Frames by frame time, in
+                                             T4K_FRAME_HIST_MS buckets; the
+                                             last also has all longer ones */
+}
+T4K_FrameStats;
+
+//=============================================================================
+//
+//  T4K_GetFrameStats
+//
+//! /brief
+//!     Sum up the last thousand or so frames. Every T4K_UpdateScreen
+//!     records a frame; frames that T4K_FrameWait found late are counted
+//!     as overruns. Safe to call from another thread.
+//!
+//! /param
+//!     stats         - Where to put the summary
+//!
+//! /return
+//!     The number of frames summed up
+//!
+int T4K_GetFrameStats( T4K_FrameStats* stats );
+
+//=============================================================================
+//
+//  T4K_SetFrameStatsFile
+//
+//! /brief
+//!     Have CleanupT4KCommon write the recorded frames, one per line, to
+//!     a CSV file.
+//!
+//! /param
+//!     path          - The file to write, or NULL for none (the default)
+//!
+//! /return
+//!     None
+//!
+void T4K_SetFrameStatsFile( const char* path );
+
+
+//=============================================================================
+//                      Public Definitions for t4k_perfhud.c
+//=============================================================================
+
+//=============================================================================
+//
+//  T4K_SetPerfHUD
+//
+//! /brief
+//!     Show or hide the performance HUD in the top right corner of the
+//!     screen: frame rate, frame and CPU times, a graph of recent frames,
+//!     blits and pixels per frame, and cache hit rates. It is drawn on
+//!     T4K_LAYER_PERF by T4K_UpdateScreen, and redrawn twice a second at
+//!     most. F12 toggles it in T4K_HandleStdEvents. After hiding it, the
+//!     game has to redraw what was underneath.
+//!
+//! /param
+//!     on            - 1 to show it, 0 to hide it
+//!
+//! /return
+//!     None
+//!
+void T4K_SetPerfHUD( int on );
+
+//=============================================================================
+//
+//  T4K_GetPerfHUD
+//
+//! /brief
+//!     Whether the performance HUD is showing.
+//!
+//! /return
+//!     1 if it is, otherwise 0
+//!
+int T4K_GetPerfHUD( void );
 
 //=============================================================================
 //                      Public Definitions for t4k_convert_utf.c
@@ -161,3 +161,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 #undef CLOCK_ASM
 #define CLOCK_ASM(x) x=42
 #endif
+
+
+// x86 SIMD kernels are built with per-function target attributes and
+// picked at runtime, so the library still runs on CPUs without them.
+// Define NO_SIMD to build only the plain C versions.
+#if !defined(NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_X86_SIMD 1
+#define TARGET(isa) __attribute__ ((__target__ (isa)))
+#endif
@@ -0,0 +1,253 @@
+/*
+   t4k_framestats.c
+
+   Per-frame timing statistics. T4K_UpdateScreen() records each frame
+   (time, CPU time, blits, pixels and update area) in a ring buffer,
+   and T4K_GetFrameStats() sums up the last few seconds of them, so a
+   game can see how smoothly it is really running.
+
+   Copyright 2010.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+t4k_framestats.c is part of the t4k_common library.
+
+t4k_common is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+t4k_common is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "t4k_common.h"
+#include "t4k_globals.h"
+#include "SDL.h"
+#include <time.h>
+
+typedef struct frameRecord
+{
+    Uint32 frame_us;    // wall time since the frame before
+    Uint32 cpu_us;      // time the main thread was busy
+    Uint32 blits;
+    Uint32 pixels;
+    Uint32 update_area;
+    Uint32 overrun;     // nonzero if T4K_FrameWait() found it late
+} frameRecord;
+
+/* The ring is written only by the thread calling T4K_UpdateScreen(), */
+/* which fills in a record and then moves ring_head past it, so a     */
+/* reader on another thread takes ring_head first and then copies     */
+/* the records before it. The oldest RING_SLACK records may be being  */
+/* overwritten meanwhile, so readers leave them out.                  */
+#define RING_SIZE 1024  // must be a power of 2
+#define RING_SLACK 16
+
+static frameRecord ring[RING_SIZE];
+static volatile unsigned long ring_head = 0;    // records ever written
+
+/* What the current frame has done so far: */
+static Uint64 frame_start_ns = 0;
+static Uint64 frame_start_cpu = 0;
+static Uint64 frame_slept_ns = 0;
+static int frame_overrun = 0;
+
+static char* csv_path = NULL;
+
+static Uint64 cpu_time_ns(void);
+static int compare_uint32(const void* a, const void* b);
+static float percentile(Uint32* sorted, int n, int pct);
+
+
+
+/* Summarize the frames recorded in the last RING_SIZE - RING_SLACK */
+int T4K_GetFrameStats(T4K_FrameStats* stats)
+{
+    Uint32 frame_us[RING_SIZE], cpu_us[RING_SIZE];
+    unsigned long head, i;
+    double blits = 0, pixels = 0, area = 0;
+    frameRecord* r;
+    int n, b;
+
+    if (!stats)
+	return 0;
+    memset(stats, 0, sizeof(T4K_FrameStats));
+
+    head = ring_head;
+    __sync_synchronize();
+    n = head < RING_SIZE - RING_SLACK ? head : RING_SIZE - RING_SLACK;
+    if (n == 0)
+	return 0;
+
+    for (i = 0; i < n; i++)
+    {
+	r = &ring[(head - n + i) & (RING_SIZE - 1)];
+	frame_us[i] = r->frame_us;
+	cpu_us[i] = r->cpu_us;
+	blits += r->blits;
+	pixels += r->pixels;
+	area += r->update_area;
+	stats->overruns += r->overrun != 0;
+
+	b = r->frame_us / (T4K_FRAME_HIST_MS * 1000);
+	if (b >= T4K_FRAME_HIST_BUCKETS)
+	    b = T4K_FRAME_HIST_BUCKETS - 1;
+	stats->histogram[b]++;
+    }
+
+    qsort(frame_us, n, sizeof(Uint32), compare_uint32);
+    qsort(cpu_us, n, sizeof(Uint32), compare_uint32);
+
+    stats->frames = n;
+    stats->frame_ms[0] = percentile(frame_us, n, 50);
+    stats->frame_ms[1] = percentile(frame_us, n, 95);
+    stats->frame_ms[2] = percentile(frame_us, n, 99);
+    stats->cpu_ms[0] = percentile(cpu_us, n, 50);
+    stats->cpu_ms[1] = percentile(cpu_us, n, 95);
+    stats->cpu_ms[2] = percentile(cpu_us, n, 99);
+    stats->blits = blits / n;
+    stats->pixels = pixels / n;
+    stats->update_area = area / n;
+    return n;
+}
+
+
+/* Copy the frame times (usec) of up to the last max frames into */
+/* frame_us, oldest first, and return how many there were.        */
+int framestats_recent(Uint32* frame_us, int max)
+{
+    unsigned long head = ring_head;
+    int i, n;
+
+    __sync_synchronize();
+    n = head < RING_SIZE - RING_SLACK ? head : RING_SIZE - RING_SLACK;
+    if (n > max)
+	n = max;
+    for (i = 0; i < n; i++)
+	frame_us[i] = ring[(head - n + i) & (RING_SIZE - 1)].frame_us;
+    return n;
+}
+
+
+/* Write the recorded frames to path at cleanup (NULL for no file) */
+void T4K_SetFrameStatsFile(const char* path)
+{
+    free(csv_path);
+    csv_path = path ? strdup(path) : NULL;
+}
+
+
+/* Called by T4K_UpdateScreen() as it finishes a frame */
+void framestats_add_frame(int blits, long pixels, long update_area)
+{
+    Uint64 now = T4K_GetTimeNS();
+    Uint64 cpu = cpu_time_ns();
+    unsigned long head = ring_head;
+    frameRecord* r = &ring[head & (RING_SIZE - 1)];
+
+    /* the first frame has nothing to measure from: */
+    if (frame_start_ns)
+    {
+	r->frame_us = (now - frame_start_ns) / 1000;
+	if (cpu)
+	    r->cpu_us = (cpu - frame_start_cpu) / 1000;
+	else
+	    r->cpu_us = (now - frame_start_ns - frame_slept_ns) / 1000;
+	r->blits = blits;
+	r->pixels = pixels;
+	r->update_area = update_area;
+	r->overrun = frame_overrun;
+
+	__sync_synchronize();
+	ring_head = head + 1;
+    }
+
+    frame_start_ns = now;
+    frame_start_cpu = cpu;
+    frame_slept_ns = 0;
+    frame_overrun = 0;
+}
+
+
+/* Called by T4K_FrameWait(), so time spent waiting isn't counted as */
+/* busy where we can't ask for the thread's CPU time.                */
+void framestats_add_wait(Uint64 slept_ns, int overrun)
+{
+    frame_slept_ns += slept_ns;
+    frame_overrun |= overrun;
+}
+
+
+/* Write the CSV file, if one was asked for */
+void framestats_cleanup(void)
+{
+    unsigned long head = ring_head, i, n;
+    frameRecord* r;
+    FILE* fp;
+
+    if (!csv_path)
+	return;
+
+    fp = fopen(csv_path, "w");
+    if (!fp)
+    {
+	fprintf(stderr, "framestats_cleanup() - could not open %s\n", csv_path);
+	free(csv_path);
+	csv_path = NULL;
+	return;
+    }
+
+    n = head < RING_SIZE ? head : RING_SIZE;
+    fprintf(fp, "frame,frame_us,cpu_us,blits,pixels,update_area,overrun\n");
+    for (i = head - n; i < head; i++)
+    {
+	r = &ring[i & (RING_SIZE - 1)];
+	fprintf(fp, "%lu,%u,%u,%u,%u,%u,%u\n", i, r->frame_us, r->cpu_us,
+		r->blits, r->pixels, r->update_area, r->overrun);
+    }
+    fclose(fp);
+    DEBUGMSG(debug_sdl, "framestats_cleanup(): wrote %lu frames to %s\n", n, csv_path);
+
+    free(csv_path);
+    csv_path = NULL;
+}
+
+
+
+/* CPU time of this thread (plus 1, so it's never 0), */
+/* or 0 if we can't tell                               */
+static Uint64 cpu_time_ns(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+	return (Uint64)ts.tv_sec * 1000000000 + ts.tv_nsec + 1;
+#endif
+    return 0;
+}
+
+
+static int compare_uint32(const void* a, const void* b)
+{
+    Uint32 x = *(const Uint32*)a, y = *(const Uint32*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+/* pct-th percentile, in msec, of n sorted values in usec */
+static float percentile(Uint32* sorted, int n, int pct)
+{
+    int i = (n * pct + 99) / 100 - 1;
+
+    if (i < 0)
+	i = 0;
+    return sorted[i] / 1000.0;
+}
@@ -71,13 +71,54 @@ Uint32 getpixel32(SDL_Surface * surface, int x, int y);
 
 extern Uint32(*getpixels[]) (SDL_Surface *, int, int);
 
+/* Convert n pixels of row y of s, from x on, to or from R, G, B, A */
+/* bytes. s must be locked, and the span must lie within it.        */
+void read_span(SDL_Surface * s, int x, int y, int n, Uint8 * rgba);
+void write_span(SDL_Surface * s, int x, int y, int n, const Uint8 * rgba);
+
 /* Non-API global functions */
 /* From t4k_menu.c */
 int         size_text(const char* text, int font_size, int* width, int* height);
 /* From t4k_loaders.c */
 const char* find_file(const char* base_name);
 void T4K_GetUserDataDir(char *opt_path, char* suffix); //TODO make t4k_fileops.c
+void        free_sprite_privs(void);
 /* From t4k_sdl.c */
 void internal_res_switch_handler(ResSwitchCallback callback);
+void free_blit_queue(void);
+void free_corner_tables(void);
+void text_cache_stats(unsigned long* hits, unsigned long* misses);
+void free_premultiplied(void);
+/* From t4k_threads.c */
+typedef void (*PoolJob)(void* arg, int band, int nbands);
+int         pool_cpu_count(void);
+int         pool_reserve(int n);
+void        pool_run(PoolJob fn, void* arg, int nbands);
+void        pool_shutdown(void);
+/* From t4k_cache.c */
+SDL_Surface* scale_cache_find(const char* path, SDL_Surface* src, int w, int h, int mode);
+void        scale_cache_add(const char* path, SDL_Surface* src, int w, int h, int mode, SDL_Surface* surf);
+void        scale_cache_free(void);
+void        cache_stats(unsigned long* hits, unsigned long* misses);
+/* From t4k_framestats.c */
+void        framestats_add_frame(int blits, long pixels, long update_area);
+void        framestats_add_wait(Uint64 slept_ns, int overrun);
+void        framestats_cleanup(void);
+int         framestats_recent(Uint32* frame_us, int max);
+/* From t4k_perfhud.c */
+void        perfhud_update(void);
+void        perfhud_free(void);
+/* From t4k_kernels.c */
+int         zoom32(SDL_Surface* src, SDL_Surface* dst, int nbands);
+int         zoom_area32(SDL_Surface* src, SDL_Surface* dst, int nbands, int premultiplied);
+void        blend32(SDL_Surface* dst, SDL_Rect* r, SDL_Surface* s1, SDL_Surface* s2,
+		    float gamma, int blend_alpha);
+void        fill_span32(Uint32* p, int n, Uint32 color, int alpha, int ai, Uint32 mask);
+void        flip32(SDL_Surface* src, SDL_Surface* dst, int x, int y);
+void        darken32(SDL_Surface* s, SDL_Rect* r, int bits);
+void        swizzle32(Uint8* dst, const Uint8* src, int n, const Uint8* idx,
+		      const Uint8* fill);
+void        over32(SDL_Surface* src, SDL_Rect* sr, SDL_Surface* dst, SDL_Rect* dr);
+void        pick_kernels(void);
 
 #endif
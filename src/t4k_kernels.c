@@ -0,0 +1,1270 @@
+/*
+   t4k_kernels.c
+
+   Fast paths for the pixel-crunching parts of t4k_common, in
+   fixed-point C with SSE2/SSSE3/AVX2 versions that are picked at
+   runtime. The callers keep their original generic code for the
+   formats these don't handle.
+
+   Copyright 2010.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+t4k_kernels.c is part of the t4k_common library.
+
+t4k_common is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+t4k_common is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t4k_globals.h"
+#include "t4k_compiler.h"
+#include "SDL.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+
+/*************************************************/
+/* CPU features                                  */
+/*************************************************/
+
+/* Every kernel below has a plain C version and, where it pays, SIMD */
+/* versions, and the best one the CPU can run is chosen the first    */
+/* time it's needed (or by pick_kernels() at InitT4KCommon() time).  */
+/* Setting T4K_FORCE_SCALAR in the environment (to anything but "0") */
+/* makes them all use the C versions, for debugging.                 */
+
+enum {
+    CPU_SSE2  = 1 << 0,
+    CPU_SSSE3 = 1 << 1,
+    CPU_AVX2  = 1 << 2
+};
+
+static int cpu_flags = -1;
+
+static int cpu_has(int feature)
+{
+    const char* force;
+
+    if (cpu_flags < 0)
+    {
+	cpu_flags = 0;
+	force = getenv("T4K_FORCE_SCALAR");
+	if (force && *force && strcmp(force, "0") != 0)
+	    return 0;
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	    cpu_flags |= CPU_SSE2;
+	if (__builtin_cpu_supports("ssse3"))
+	    cpu_flags |= CPU_SSSE3;
+	if (__builtin_cpu_supports("avx2"))
+	    cpu_flags |= CPU_AVX2;
+#endif
+    }
+    return (cpu_flags & feature) != 0;
+}
+
+
+/*************************************************/
+/* Bilinear scaling of 32 bit surfaces           */
+/*************************************************/
+
+/* This does the same thing as the float code in T4K_zoom(), but one */
+/* output row at a time: the two source rows are blended into a      */
+/* temporary row, which is then sampled at precomputed columns. All  */
+/* weights are 8.8 fixed point. The channels are never unpacked, so  */
+/* the byte order of the format doesn't matter.                      */
+
+/* blend two rows of w pixels: dst = (r0 * (256 - wy) + r1 * wy) / 256 */
+typedef void (*LerpRowsFn)(Uint32* dst, const Uint32* r0, const Uint32* r1, int w, int wy);
+/* sample w output pixels from src; column x blends src[col[x]] and      */
+/* src[col[x] + 1] using the weights wts[x * 8 .. x * 8 + 7], which are */
+/* four copies of the left weight followed by four of the right one     */
+typedef void (*LerpColsFn)(Uint32* dst, const Uint32* src, const int* col,
+	const Uint16* wts, int w, Uint32 mask);
+
+static LerpRowsFn lerp_rows = NULL;
+static LerpColsFn lerp_cols = NULL;
+
+static void lerp_rows_c(Uint32* dst, const Uint32* r0, const Uint32* r1, int w, int wy)
+{
+    const Uint8* a = (const Uint8*)r0;
+    const Uint8* b = (const Uint8*)r1;
+    Uint8* d = (Uint8*)dst;
+    int i, iwy = 256 - wy;
+
+    for (i = 0; i < w * 4; i++)
+	d[i] = (a[i] * iwy + b[i] * wy + 128) >> 8;
+}
+
+static void lerp_cols_c(Uint32* dst, const Uint32* src, const int* col,
+	const Uint16* wts, int w, Uint32 mask)
+{
+    const Uint8* p;
+    Uint8* d;
+    int x, c, wx, iwx;
+
+    for (x = 0; x < w; x++)
+    {
+	p = (const Uint8*)(src + col[x]);
+	d = (Uint8*)(dst + x);
+	iwx = wts[x * 8];
+	wx = wts[x * 8 + 4];
+	for (c = 0; c < 4; c++)
+	    d[c] = (p[c] * iwx + p[c + 4] * wx + 128) >> 8;
+	dst[x] &= mask;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+TARGET("sse2")
+static void lerp_rows_sse2(Uint32* dst, const Uint32* r0, const Uint32* r1, int w, int wy)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i half = _mm_set1_epi16(128);
+    __m128i w0 = _mm_set1_epi16(256 - wy);
+    __m128i w1 = _mm_set1_epi16(wy);
+    __m128i a, b, lo, hi;
+    int i;
+
+    for (i = 0; i + 4 <= w; i += 4)
+    {
+	a = _mm_loadu_si128((const __m128i*)(r0 + i));
+	b = _mm_loadu_si128((const __m128i*)(r1 + i));
+	lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0),
+		_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+	hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0),
+		_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+	lo = _mm_srli_epi16(_mm_add_epi16(lo, half), 8);
+	hi = _mm_srli_epi16(_mm_add_epi16(hi, half), 8);
+	_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    lerp_rows_c(dst + i, r0 + i, r1 + i, w - i, wy);
+}
+
+TARGET("sse2")
+static void lerp_cols_sse2(Uint32* dst, const Uint32* src, const int* col,
+	const Uint16* wts, int w, Uint32 mask)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i half = _mm_set1_epi16(128);
+    __m128i m = _mm_set1_epi32(mask);
+    __m128i p, a, b, s;
+    int x;
+
+    /* two output pixels at a time: */
+    for (x = 0; x + 2 <= w; x += 2)
+    {
+	p = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(src + col[x])),
+		_mm_loadl_epi64((const __m128i*)(src + col[x + 1])));
+	a = _mm_mullo_epi16(_mm_unpacklo_epi8(p, zero),
+		_mm_loadu_si128((const __m128i*)(wts + x * 8)));
+	b = _mm_mullo_epi16(_mm_unpackhi_epi8(p, zero),
+		_mm_loadu_si128((const __m128i*)(wts + x * 8 + 8)));
+	s = _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+	s = _mm_srli_epi16(_mm_add_epi16(s, half), 8);
+	s = _mm_and_si128(_mm_packus_epi16(s, s), m);
+	_mm_storel_epi64((__m128i*)(dst + x), s);
+    }
+    lerp_cols_c(dst + x, src, col + x, wts + x * 8, w - x, mask);
+}
+
+TARGET("avx2")
+static void lerp_rows_avx2(Uint32* dst, const Uint32* r0, const Uint32* r1, int w, int wy)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i half = _mm256_set1_epi16(128);
+    __m256i w0 = _mm256_set1_epi16(256 - wy);
+    __m256i w1 = _mm256_set1_epi16(wy);
+    __m256i a, b, lo, hi;
+    int i;
+
+    for (i = 0; i + 8 <= w; i += 8)
+    {
+	a = _mm256_loadu_si256((const __m256i*)(r0 + i));
+	b = _mm256_loadu_si256((const __m256i*)(r1 + i));
+	lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), w0),
+		_mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), w1));
+	hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), w0),
+		_mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), w1));
+	lo = _mm256_srli_epi16(_mm256_add_epi16(lo, half), 8);
+	hi = _mm256_srli_epi16(_mm256_add_epi16(hi, half), 8);
+	_mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    lerp_rows_sse2(dst + i, r0 + i, r1 + i, w - i, wy);
+}
+
+TARGET("avx2")
+static void lerp_cols_avx2(Uint32* dst, const Uint32* src, const int* col,
+	const Uint16* wts, int w, Uint32 mask)
+{
+    __m256i half = _mm256_set1_epi16(128);
+    __m128i m = _mm_set1_epi32(mask);
+    __m128i pa, pb, lo, hi;
+    __m256i a, b, s;
+    int x;
+
+    /* four output pixels at a time: */
+    for (x = 0; x + 4 <= w; x += 4)
+    {
+	pa = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(src + col[x])),
+		_mm_loadl_epi64((const __m128i*)(src + col[x + 1])));
+	pb = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(src + col[x + 2])),
+		_mm_loadl_epi64((const __m128i*)(src + col[x + 3])));
+	a = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(pa),
+		_mm256_loadu_si256((const __m256i*)(wts + x * 8)));
+	b = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(pb),
+		_mm256_loadu_si256((const __m256i*)(wts + x * 8 + 16)));
+	/* low lane now holds pixels 0 and 2, high lane 1 and 3: */
+	s = _mm256_add_epi16(_mm256_unpacklo_epi64(a, b), _mm256_unpackhi_epi64(a, b));
+	s = _mm256_srli_epi16(_mm256_add_epi16(s, half), 8);
+	s = _mm256_packus_epi16(s, s);
+	lo = _mm256_castsi256_si128(s);
+	hi = _mm256_extracti128_si256(s, 1);
+	_mm_storeu_si128((__m128i*)(dst + x), _mm_and_si128(_mm_unpacklo_epi32(lo, hi), m));
+    }
+    lerp_cols_sse2(dst + x, src, col + x, wts + x * 8, w - x, mask);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+
+static void pick_zoom_kernels(void)
+{
+    lerp_rows = lerp_rows_c;
+    lerp_cols = lerp_cols_c;
+#ifdef HAVE_X86_SIMD
+    if (cpu_has(CPU_AVX2))
+    {
+	lerp_rows = lerp_rows_avx2;
+	lerp_cols = lerp_cols_avx2;
+    }
+    else if (cpu_has(CPU_SSE2))
+    {
+	lerp_rows = lerp_rows_sse2;
+	lerp_cols = lerp_cols_sse2;
+    }
+#endif
+}
+
+
+/* What each band of a zoom32() job needs: */
+struct zoom_job {
+    SDL_Surface* src;
+    SDL_Surface* dst;
+    int* col;       // first source column of each output column
+    Uint16* wts;    // and its weights, as described for LerpColsFn
+    Uint32* tmp;    // one temporary row per band
+    Uint32 mask;
+};
+
+static void zoom_band(void* arg, int band, int nbands);
+
+
+/* Scale src into dst, both 32 bits per pixel and in the same format, */
+/* splitting the output rows into nbands bands for the worker pool.   */
+/* Every row is computed the same way whatever band it falls in, so   */
+/* the result doesn't depend on nbands. Both surfaces must already be */
+/* locked. Returns 0 if we ran out of memory, in which case dst       */
+/* hasn't been touched.                                               */
+int zoom32(SDL_Surface* src, SDL_Surface* dst, int nbands)
+{
+    struct zoom_job job;
+    Uint64 pos;
+    int x;
+
+    if (src->w < 1 || src->h < 1 || dst->w < 1 || dst->h < 1)
+	return 0;
+
+    if (nbands > dst->h)
+	nbands = dst->h;
+    if (nbands < 1)
+	nbands = 1;
+
+    if (!lerp_rows)
+	pick_zoom_kernels();
+
+    job.src = src;
+    job.dst = dst;
+    job.col = malloc(dst->w * sizeof(int));
+    job.wts = malloc(dst->w * 8 * sizeof(Uint16));
+    /* one spare pixel, so the last column can blend with "itself": */
+    job.tmp = malloc(nbands * (src->w + 1) * sizeof(Uint32));
+    if (!job.col || !job.wts || !job.tmp)
+    {
+	free(job.col);
+	free(job.wts);
+	free(job.tmp);
+	return 0;
+    }
+
+    /* -- where each output column comes from, and with what weights -- */
+    for (x = 0; x < dst->w; x++)
+    {
+	pos = ((Uint64)x * src->w << 16) / dst->w;
+	job.col[x] = pos >> 16;
+	job.wts[x * 8] = job.wts[x * 8 + 1] = job.wts[x * 8 + 2] = job.wts[x * 8 + 3] = 256 - ((pos >> 8) & 0xff);
+	job.wts[x * 8 + 4] = job.wts[x * 8 + 5] = job.wts[x * 8 + 6] = job.wts[x * 8 + 7] = (pos >> 8) & 0xff;
+    }
+
+    /* without an alpha channel, leave the unused byte zeroed like SDL_MapRGBA() would: */
+    job.mask = dst->format->Rmask | dst->format->Gmask | dst->format->Bmask | dst->format->Amask;
+
+    pool_run(zoom_band, &job, nbands);
+
+    free(job.col);
+    free(job.wts);
+    free(job.tmp);
+    return 1;
+}
+
+
+/* Scale one band of output rows, top to bottom */
+static void zoom_band(void* arg, int band, int nbands)
+{
+    struct zoom_job* job = arg;
+    SDL_Surface* src = job->src;
+    SDL_Surface* dst = job->dst;
+    Uint32* tmp = job->tmp + band * (src->w + 1);
+    Uint32* row;
+    Uint32 *r0, *r1;
+    Uint64 pos;
+    int y, fy, wy, prev_fy = -1, prev_wy = -1;
+    int top = dst->h * band / nbands;
+    int bottom = dst->h * (band + 1) / nbands;
+
+    for (y = top; y < bottom; y++)
+    {
+	pos = ((Uint64)y * src->h << 16) / dst->h;
+	fy = pos >> 16;
+	wy = (pos >> 8) & 0xff;
+
+	/* when enlarging, several output rows often come from the same place: */
+	if (fy != prev_fy || wy != prev_wy)
+	{
+	    r0 = (Uint32*)((Uint8*)src->pixels + fy * src->pitch);
+	    if (wy == 0 || fy + 1 >= src->h)
+		memcpy(tmp, r0, src->w * sizeof(Uint32));
+	    else
+	    {
+		r1 = (Uint32*)((Uint8*)r0 + src->pitch);
+		lerp_rows(tmp, r0, r1, src->w, wy);
+	    }
+	    tmp[src->w] = tmp[src->w - 1];
+	    prev_fy = fy;
+	    prev_wy = wy;
+	}
+
+	row = (Uint32*)((Uint8*)dst->pixels + y * dst->pitch);
+	lerp_cols(row, tmp, job->col, job->wts, dst->w, job->mask);
+    }
+}
+
+
+/*************************************************/
+/* Area-average scaling of 32 bit surfaces       */
+/*************************************************/
+
+/* A separable resampler: each output column (then row) is a weighted */
+/* sum of a run of source columns (rows). When shrinking an axis, the */
+/* weights are how much of each source pixel the output pixel covers, */
+/* so every source pixel counts and nothing aliases; when enlarging   */
+/* one, they are the same two bilinear taps T4K_zoom() uses. Colors   */
+/* are weighted by alpha, so transparent pixels don't darken edges.   */
+/* Weights are 2.14 fixed point and add up to exactly 1.              */
+#define TAP_BITS 14
+#define TAP_ONE (1 << TAP_BITS)
+
+struct taps {
+    int* first;     // first source pixel of each output pixel
+    int* count;     // how many source pixels it uses
+    int* start;     // where its weights begin in w[]
+    Uint16* w;
+};
+
+/* Pass 1 writes dst->w x src->h pixels of four Uint16 channels to tmp:  */
+/* colors premultiplied by alpha (up to 255 * 255), and alpha * 255.    */
+/* Pass 2 reads them back a column at a time to make the output rows.   */
+/* Without alpha, the spare byte (if any) carries an alpha of 255. If   */
+/* the colors are premultiplied already, all four channels are just     */
+/* scaled by 255 and averaged alike.                                    */
+struct area_job {
+    SDL_Surface* src;
+    SDL_Surface* dst;
+    struct taps cols;
+    struct taps rows;
+    Uint16* tmp;
+    int ai;         // byte offset of alpha (or the spare byte) in a pixel, or -1
+    int has_alpha;
+    int premultiplied;
+    Uint32 mask;
+};
+
+static int build_taps(struct taps* t, int src_n, int dst_n);
+static void free_taps(struct taps* t);
+static void area_rows_band(void* arg, int band, int nbands);
+static void area_cols_band(void* arg, int band, int nbands);
+
+
+/* Scale src into dst (both 32 bits per pixel, same format, locked) by */
+/* area averaging, with nbands bands per pass on the worker pool. Set  */
+/* premultiplied if src's colors are already multiplied by its alpha.  */
+/* Returns 0 if we ran out of memory, leaving dst untouched.           */
+int zoom_area32(SDL_Surface* src, SDL_Surface* dst, int nbands, int premultiplied)
+{
+    struct area_job job;
+    Uint32 m;
+    int ok, c;
+
+    if (src->w < 1 || src->h < 1 || dst->w < 1 || dst->h < 1)
+	return 0;
+
+    if (nbands < 1)
+	nbands = 1;
+
+    job.src = src;
+    job.dst = dst;
+    job.tmp = malloc((size_t)dst->w * src->h * 4 * sizeof(Uint16));
+    ok = job.tmp != NULL;
+    ok = build_taps(&job.cols, src->w, dst->w) && ok;
+    ok = build_taps(&job.rows, src->h, dst->h) && ok;
+    if (!ok)
+    {
+	free_taps(&job.cols);
+	free_taps(&job.rows);
+	free(job.tmp);
+	return 0;
+    }
+
+    m = dst->format->Amask ? dst->format->Amask
+	: ~(dst->format->Rmask | dst->format->Gmask | dst->format->Bmask);
+    job.ai = -1;
+    for (c = 0; c < 4; c++)
+    {
+	if (((m >> (8 * c)) & 0xff) == 0xff)
+	{
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	    job.ai = 3 - c;
+#else
+	    job.ai = c;
+#endif
+	    break;
+	}
+    }
+    job.has_alpha = dst->format->Amask && job.ai >= 0;
+    job.premultiplied = premultiplied && job.has_alpha;
+    job.mask = dst->format->Rmask | dst->format->Gmask | dst->format->Bmask | dst->format->Amask;
+
+    pool_run(area_rows_band, &job, (nbands < src->h) ? nbands : src->h);
+    pool_run(area_cols_band, &job, (nbands < dst->h) ? nbands : dst->h);
+
+    free_taps(&job.cols);
+    free_taps(&job.rows);
+    free(job.tmp);
+    return 1;
+}
+
+
+/* Work out the weights for scaling src_n pixels down (or up) to dst_n */
+static int build_taps(struct taps* t, int src_n, int dst_n)
+{
+    double scale = (double)src_n / dst_n;
+    double lo, hi, cover;
+    int i, j, n, sum, big, max_taps;
+    Uint64 pos;
+    Uint16* w;
+
+    max_taps = (dst_n < src_n) ? (int)scale + 2 : 2;
+    t->first = malloc(dst_n * sizeof(int));
+    t->count = malloc(dst_n * sizeof(int));
+    t->start = malloc(dst_n * sizeof(int));
+    t->w = malloc((size_t)dst_n * max_taps * sizeof(Uint16));
+    if (!t->first || !t->count || !t->start || !t->w)
+	return 0;
+
+    for (i = 0, n = 0; i < dst_n; i++)
+    {
+	w = t->w + n;
+	t->start[i] = n;
+
+	if (dst_n < src_n)
+	{
+	    /* the output pixel covers [lo, hi) of the source: */
+	    lo = i * scale;
+	    hi = (i + 1) * scale;
+	    t->first[i] = (int)lo;
+	    t->count[i] = (int)ceil(hi) - t->first[i];
+	    if (t->first[i] + t->count[i] > src_n)
+		t->count[i] = src_n - t->first[i];
+
+	    sum = big = 0;
+	    for (j = 0; j < t->count[i]; j++)
+	    {
+		cover = ((hi < t->first[i] + j + 1) ? hi : t->first[i] + j + 1)
+		    - ((lo > t->first[i] + j) ? lo : t->first[i] + j);
+		w[j] = (Uint16)(cover / scale * TAP_ONE + 0.5);
+		sum += w[j];
+		if (w[j] > w[big])
+		    big = j;
+	    }
+	    /* make the weights add up to exactly 1: */
+	    w[big] += TAP_ONE - sum;
+	}
+	else
+	{
+	    /* same sample positions as T4K_zoom(): */
+	    pos = ((Uint64)i * src_n << 16) / dst_n;
+	    t->first[i] = pos >> 16;
+	    w[1] = ((pos & 0xffff) * TAP_ONE + 0x8000) >> 16;
+	    w[0] = TAP_ONE - w[1];
+	    t->count[i] = (w[1] == 0 || t->first[i] + 1 >= src_n) ? 1 : 2;
+	    if (t->count[i] == 1)
+		w[0] = TAP_ONE;
+	}
+	n += t->count[i];
+    }
+    return 1;
+}
+
+
+static void free_taps(struct taps* t)
+{
+    free(t->first);
+    free(t->count);
+    free(t->start);
+    free(t->w);
+}
+
+
+/* Pass 1: resample one band of source rows horizontally into tmp */
+static void area_rows_band(void* arg, int band, int nbands)
+{
+    struct area_job* job = arg;
+    SDL_Surface* src = job->src;
+    struct taps* t = &job->cols;
+    const Uint8* row;
+    const Uint8* p;
+    Uint16* out;
+    Uint32 acc[4];
+    Uint32 a, wt;
+    int x, y, j, c;
+    int top = src->h * band / nbands;
+    int bottom = src->h * (band + 1) / nbands;
+
+    for (y = top; y < bottom; y++)
+    {
+	row = (const Uint8*)src->pixels + y * src->pitch;
+	out = job->tmp + (size_t)y * job->dst->w * 4;
+
+	for (x = 0; x < job->dst->w; x++)
+	{
+	    acc[0] = acc[1] = acc[2] = acc[3] = 0;
+	    p = row + t->first[x] * 4;
+	    for (j = 0; j < t->count[x]; j++, p += 4)
+	    {
+		wt = t->w[t->start[x] + j];
+		if (job->premultiplied)
+		{
+		    for (c = 0; c < 4; c++)
+			acc[c] += p[c] * 255 * wt;
+		    continue;
+		}
+		a = job->has_alpha ? p[job->ai] : 255;
+		for (c = 0; c < 4; c++)
+		    acc[c] += ((c == job->ai) ? a * 255 : p[c] * a) * wt;
+	    }
+	    for (c = 0; c < 4; c++)
+		out[x * 4 + c] = (acc[c] + TAP_ONE / 2) >> TAP_BITS;
+	}
+    }
+}
+
+
+/* Pass 2: resample tmp vertically into one band of output rows */
+static void area_cols_band(void* arg, int band, int nbands)
+{
+    struct area_job* job = arg;
+    SDL_Surface* dst = job->dst;
+    struct taps* t = &job->rows;
+    const Uint16* p;
+    Uint8* out;
+    Uint32 acc[4];
+    Uint32 wt, alpha, v;
+    int x, y, j, c;
+    int top = dst->h * band / nbands;
+    int bottom = dst->h * (band + 1) / nbands;
+    int ai = job->ai;
+
+    for (y = top; y < bottom; y++)
+    {
+	out = (Uint8*)dst->pixels + y * dst->pitch;
+
+	for (x = 0; x < dst->w; x++, out += 4)
+	{
+	    acc[0] = acc[1] = acc[2] = acc[3] = 0;
+	    p = job->tmp + ((size_t)t->first[y] * dst->w + x) * 4;
+	    for (j = 0; j < t->count[y]; j++, p += dst->w * 4)
+	    {
+		wt = t->w[t->start[y] + j];
+		for (c = 0; c < 4; c++)
+		    acc[c] += p[c] * wt;
+	    }
+
+	    /* un-premultiply (unless they came premultiplied): */
+	    alpha = (ai >= 0) ? acc[ai] : 255 * 255 * TAP_ONE;
+	    for (c = 0; c < 4; c++)
+	    {
+		if (c == ai || job->premultiplied)
+		    out[c] = ((Uint64)acc[c] + 255 * TAP_ONE / 2) / (255 * TAP_ONE);
+		else if (alpha)
+		{
+		    /* (rounding can leave a color a hair above its alpha) */
+		    v = ((Uint64)acc[c] * 255 + alpha / 2) / alpha;
+		    out[c] = (v > 255) ? 255 : v;
+		}
+		else
+		    out[c] = 0;
+	    }
+	    *(Uint32*)out &= job->mask;
+	}
+    }
+}
+
+
+
+/*************************************************/
+/* Blending of 32 bit surfaces                   */
+/*************************************************/
+
+/* dst = (a * wa + b * wb) / 256, a byte at a time. As with the zoom  */
+/* kernels the byte order doesn't matter, but here every byte of a    */
+/* pixel has its own weight, so alpha can be treated differently from */
+/* the colors: wa and wb hold the four weights, then the same again.  */
+typedef void (*BlendSpanFn)(Uint32* dst, const Uint32* a, const Uint32* b, int n,
+	const Uint16* wa, const Uint16* wb, Uint32 mask);
+
+static BlendSpanFn blend_span = NULL;
+
+static void blend_span_c(Uint32* dst, const Uint32* a, const Uint32* b, int n,
+	const Uint16* wa, const Uint16* wb, Uint32 mask)
+{
+    const Uint8* pa;
+    const Uint8* pb;
+    Uint8* d;
+    int i, c;
+
+    for (i = 0; i < n; i++)
+    {
+	pa = (const Uint8*)(a + i);
+	pb = (const Uint8*)(b + i);
+	d = (Uint8*)(dst + i);
+	for (c = 0; c < 4; c++)
+	    d[c] = (pa[c] * wa[c] + pb[c] * wb[c]) >> 8;
+	dst[i] &= mask;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+TARGET("sse2")
+static void blend_span_sse2(Uint32* dst, const Uint32* a, const Uint32* b, int n,
+	const Uint16* wa, const Uint16* wb, Uint32 mask)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i m = _mm_set1_epi32(mask);
+    __m128i w0 = _mm_loadu_si128((const __m128i*)wa);
+    __m128i w1 = _mm_loadu_si128((const __m128i*)wb);
+    __m128i pa, pb, lo, hi;
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+	pa = _mm_loadu_si128((const __m128i*)(a + i));
+	pb = _mm_loadu_si128((const __m128i*)(b + i));
+	lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pa, zero), w0),
+		_mm_mullo_epi16(_mm_unpacklo_epi8(pb, zero), w1));
+	hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pa, zero), w0),
+		_mm_mullo_epi16(_mm_unpackhi_epi8(pb, zero), w1));
+	lo = _mm_srli_epi16(lo, 8);
+	hi = _mm_srli_epi16(hi, 8);
+	_mm_storeu_si128((__m128i*)(dst + i), _mm_and_si128(_mm_packus_epi16(lo, hi), m));
+    }
+    blend_span_c(dst + i, a + i, b + i, n - i, wa, wb, mask);
+}
+
+TARGET("avx2")
+static void blend_span_avx2(Uint32* dst, const Uint32* a, const Uint32* b, int n,
+	const Uint16* wa, const Uint16* wb, Uint32 mask)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i m = _mm256_set1_epi32(mask);
+    __m256i w0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)wa));
+    __m256i w1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)wb));
+    __m256i pa, pb, lo, hi;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+	pa = _mm256_loadu_si256((const __m256i*)(a + i));
+	pb = _mm256_loadu_si256((const __m256i*)(b + i));
+	lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(pa, zero), w0),
+		_mm256_mullo_epi16(_mm256_unpacklo_epi8(pb, zero), w1));
+	hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(pa, zero), w0),
+		_mm256_mullo_epi16(_mm256_unpackhi_epi8(pb, zero), w1));
+	lo = _mm256_srli_epi16(lo, 8);
+	hi = _mm256_srli_epi16(hi, 8);
+	_mm256_storeu_si256((__m256i*)(dst + i), _mm256_and_si256(_mm256_packus_epi16(lo, hi), m));
+    }
+    blend_span_sse2(dst + i, a + i, b + i, n - i, wa, wb, mask);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+
+static void pick_blend_kernels(void)
+{
+    blend_span = blend_span_c;
+#ifdef HAVE_X86_SIMD
+    if (cpu_has(CPU_AVX2))
+	blend_span = blend_span_avx2;
+    else if (cpu_has(CPU_SSE2))
+	blend_span = blend_span_sse2;
+#endif
+}
+
+
+/* Mix color into the n pixels at p with weight alpha (0 - 256), */
+/* leaving byte ai (the alpha channel, or -1 for none) as it is.  */
+void fill_span32(Uint32* p, int n, Uint32 color, int alpha, int ai, Uint32 mask)
+{
+    Uint32 colors[64];
+    Uint16 wa[8], wb[8];
+    int i, c;
+
+    if (!blend_span)
+	pick_blend_kernels();
+
+    for (c = 0; c < 8; c++)
+    {
+	wa[c] = (c % 4 == ai) ? 256 : 256 - alpha;
+	wb[c] = (c % 4 == ai) ? 0 : alpha;
+    }
+    for (i = 0; i < 64 && i < n; i++)
+	colors[i] = color;
+
+    for (i = 0; i < n; i += 64)
+	blend_span(p + i, p + i, colors, (n - i < 64) ? n - i : 64, wa, wb, mask);
+}
+
+
+/* Blend s1 and s2 into the rect r of dst, as T4K_Blend() does: every  */
+/* channel becomes s1 * gamma + s2 * (1 - gamma), with the two lined up */
+/* at the bottom. Rows of s1 that s2 doesn't reach, or all of them if   */
+/* s2 is NULL, just get their alpha faded by gamma - or, if dst has no  */
+/* alpha, their colors, so they fade to black. Unless blend_alpha is    */
+/* set, alpha is copied from s1 as is. All three must be 32 bit, in the */
+/* same format, and locked; r must lie within both dst and s1, which    */
+/* may be the same surface. s2 must be as wide as s1.                   */
+void blend32(SDL_Surface* dst, SDL_Rect* r, SDL_Surface* s1, SDL_Surface* s2,
+	float gamma, int blend_alpha)
+{
+    Uint16 fade_a[8], fade_b[8], mix_a[8], mix_b[8];
+    Uint32 *d, *a;
+    Uint32 mask;
+    int g, c, ai, y, y2;
+
+    if (!blend_span)
+	pick_blend_kernels();
+
+    g = gamma * 256 + 0.5;
+
+    ai = -1;
+    if (dst->format->Amask)
+    {
+	ai = dst->format->Ashift / 8;
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	ai = 3 - ai;
+#endif
+    }
+
+    /* weights for rows s2 covers (mix), and for those it doesn't (fade) */
+    for (c = 0; c < 8; c++)
+    {
+	if (c % 4 != ai)
+	{
+	    mix_a[c] = g;
+	    mix_b[c] = 256 - g;
+	    fade_a[c] = (ai < 0) ? g : 256;
+	}
+	else if (blend_alpha)
+	{
+	    mix_a[c] = g;
+	    mix_b[c] = 256 - g;
+	    fade_a[c] = g;
+	}
+	else
+	{
+	    mix_a[c] = 256;
+	    mix_b[c] = 0;
+	    fade_a[c] = 256;
+	}
+	fade_b[c] = 0;
+    }
+
+    /* without an alpha channel, leave the unused byte zeroed like SDL_MapRGBA() would: */
+    mask = dst->format->Rmask | dst->format->Gmask | dst->format->Bmask | dst->format->Amask;
+
+    for (y = r->y; y < r->y + r->h; y++)
+    {
+	d = (Uint32*)((Uint8*)dst->pixels + y * dst->pitch) + r->x;
+	a = (Uint32*)((Uint8*)s1->pixels + y * s1->pitch) + r->x;
+
+	y2 = s2 ? y + s2->h - s1->h : -1;
+	if (y2 >= 0 && y2 < s2->h)
+	    blend_span(d, a, (Uint32*)((Uint8*)s2->pixels + y2 * s2->pitch) + r->x,
+		    r->w, mix_a, mix_b, mask);
+	else
+	    blend_span(d, a, a, r->w, fade_a, fade_b, mask);
+    }
+}
+
+
+
+/*************************************************/
+/* Mirroring of 32 bit surfaces                  */
+/*************************************************/
+
+/* dst[i] = src[w - 1 - i] */
+typedef void (*ReverseRowFn)(Uint32* dst, const Uint32* src, int w);
+
+static ReverseRowFn reverse_row = NULL;
+
+static void reverse_row_c(Uint32* dst, const Uint32* src, int w)
+{
+    int i;
+
+    for (i = 0; i < w; i++)
+	dst[i] = src[w - 1 - i];
+}
+
+#ifdef HAVE_X86_SIMD
+
+TARGET("sse2")
+static void reverse_row_sse2(Uint32* dst, const Uint32* src, int w)
+{
+    __m128i v;
+    int i;
+
+    for (i = 0; i + 4 <= w; i += 4)
+    {
+	v = _mm_loadu_si128((const __m128i*)(src + w - 4 - i));
+	_mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+    reverse_row_c(dst + i, src, w - i);
+}
+
+TARGET("avx2")
+static void reverse_row_avx2(Uint32* dst, const Uint32* src, int w)
+{
+    __m256i rev = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i v;
+    int i;
+
+    for (i = 0; i + 8 <= w; i += 8)
+    {
+	v = _mm256_loadu_si256((const __m256i*)(src + w - 8 - i));
+	_mm256_storeu_si256((__m256i*)(dst + i), _mm256_permutevar8x32_epi32(v, rev));
+    }
+    reverse_row_sse2(dst + i, src, w - i);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+
+static void pick_flip_kernels(void)
+{
+    reverse_row = reverse_row_c;
+#ifdef HAVE_X86_SIMD
+    if (cpu_has(CPU_AVX2))
+	reverse_row = reverse_row_avx2;
+    else if (cpu_has(CPU_SSE2))
+	reverse_row = reverse_row_sse2;
+#endif
+}
+
+
+/* Copy src into dst mirrored left to right if x is set, and top to */
+/* bottom if y is set. Both must be 32 bit, the same size, locked,  */
+/* and different surfaces.                                          */
+void flip32(SDL_Surface* src, SDL_Surface* dst, int x, int y)
+{
+    const Uint32* s;
+    Uint32* d;
+    int j;
+
+    if (!reverse_row)
+	pick_flip_kernels();
+
+    for (j = 0; j < dst->h; j++)
+    {
+	s = (const Uint32*)((Uint8*)src->pixels + (y ? src->h - 1 - j : j) * src->pitch);
+	d = (Uint32*)((Uint8*)dst->pixels + j * dst->pitch);
+	if (x)
+	    reverse_row(d, s, dst->w);
+	else
+	    memcpy(d, s, dst->w * 4);
+    }
+}
+
+
+
+/*************************************************/
+/* Darkening of 32 bit surfaces                  */
+/*************************************************/
+
+/* p = (p >> bits) & keep, which halves every channel bits times as */
+/* long as keep holds only the bits that stay within their channel. */
+typedef void (*DarkenSpanFn)(Uint32* p, int n, int bits, Uint32 keep);
+
+static DarkenSpanFn darken_span = NULL;
+
+static void darken_span_c(Uint32* p, int n, int bits, Uint32 keep)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+	p[i] = (p[i] >> bits) & keep;
+}
+
+#ifdef HAVE_X86_SIMD
+
+TARGET("sse2")
+static void darken_span_sse2(Uint32* p, int n, int bits, Uint32 keep)
+{
+    __m128i k = _mm_set1_epi32(keep);
+    __m128i sh = _mm_cvtsi32_si128(bits);
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+	_mm_storeu_si128((__m128i*)(p + i),
+		_mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((__m128i*)(p + i)), sh), k));
+    darken_span_c(p + i, n - i, bits, keep);
+}
+
+TARGET("avx2")
+static void darken_span_avx2(Uint32* p, int n, int bits, Uint32 keep)
+{
+    __m256i k = _mm256_set1_epi32(keep);
+    __m128i sh = _mm_cvtsi32_si128(bits);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+	_mm256_storeu_si256((__m256i*)(p + i),
+		_mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256((__m256i*)(p + i)), sh), k));
+    darken_span_sse2(p + i, n - i, bits, keep);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+
+static void pick_darken_kernels(void)
+{
+    darken_span = darken_span_c;
+#ifdef HAVE_X86_SIMD
+    if (cpu_has(CPU_AVX2))
+	darken_span = darken_span_avx2;
+    else if (cpu_has(CPU_SSE2))
+	darken_span = darken_span_sse2;
+#endif
+}
+
+
+/* Darken the rect r of the 32 bit surface s (locked, r inside it) by */
+/* 2^bits, as T4K_DarkenScreen() does. Alpha (or the spare byte)      */
+/* ends up zeroed.                                                    */
+void darken32(SDL_Surface* s, SDL_Rect* r, int bits)
+{
+    SDL_PixelFormat* f = s->format;
+    Uint32 keep;
+    int y;
+
+    if (!darken_span)
+	pick_darken_kernels();
+
+    keep = ((f->Rmask >> bits) & f->Rmask)
+	| ((f->Gmask >> bits) & f->Gmask)
+	| ((f->Bmask >> bits) & f->Bmask);
+
+    for (y = r->y; y < r->y + r->h; y++)
+	darken_span((Uint32*)((Uint8*)s->pixels + y * s->pitch) + r->x, r->w, bits, keep);
+}
+
+
+
+/*************************************************/
+/* Byte reordering of 32 bit pixels              */
+/*************************************************/
+
+/* For read_span() and write_span() in t4k_pixels.c: byte i of each */
+/* pixel of dst is byte idx[i] of the same pixel of src, or 0 if     */
+/* idx[i] is 0x80, and then or'ed with byte i of fill.               */
+typedef void (*SwizzleFn)(Uint8* dst, const Uint8* src, int n, const Uint8* idx,
+	const Uint8* fill);
+
+static SwizzleFn swizzle = NULL;
+
+static void swizzle_c(Uint8* dst, const Uint8* src, int n, const Uint8* idx,
+	const Uint8* fill)
+{
+    Uint8 p[4];
+    int i, k;
+
+    for (i = 0; i < n; i++, src += 4, dst += 4)
+    {
+	for (k = 0; k < 4; k++)
+	    p[k] = (idx[k] < 4 ? src[idx[k]] : 0) | fill[k];
+	memcpy(dst, p, 4);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* pshufb does it all, given the byte indices for four pixels: */
+static void swizzle_masks(const Uint8* idx, const Uint8* fill, Uint8* shuf, Uint8* or)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+	shuf[i] = idx[i & 3] < 4 ? (i & ~3) + idx[i & 3] : 0x80;
+	or[i] = fill[i & 3];
+    }
+}
+
+TARGET("ssse3")
+static void swizzle_ssse3(Uint8* dst, const Uint8* src, int n, const Uint8* idx,
+	const Uint8* fill)
+{
+    Uint8 shuf[16], or[16];
+    __m128i s, f;
+    int i;
+
+    swizzle_masks(idx, fill, shuf, or);
+    s = _mm_loadu_si128((__m128i*)shuf);
+    f = _mm_loadu_si128((__m128i*)or);
+    for (i = 0; i + 4 <= n; i += 4)
+	_mm_storeu_si128((__m128i*)(dst + i * 4),
+		_mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(src + i * 4)), s), f));
+    swizzle_c(dst + i * 4, src + i * 4, n - i, idx, fill);
+}
+
+TARGET("avx2")
+static void swizzle_avx2(Uint8* dst, const Uint8* src, int n, const Uint8* idx,
+	const Uint8* fill)
+{
+    Uint8 shuf[16], or[16];
+    __m256i s, f;
+    int i;
+
+    swizzle_masks(idx, fill, shuf, or);
+    s = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)shuf));
+    f = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)or));
+    for (i = 0; i + 8 <= n; i += 8)
+	_mm256_storeu_si256((__m256i*)(dst + i * 4),
+		_mm256_or_si256(_mm256_shuffle_epi8(
+			_mm256_loadu_si256((__m256i*)(src + i * 4)), s), f));
+    swizzle_ssse3(dst + i * 4, src + i * 4, n - i, idx, fill);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+
+static void pick_swizzle_kernels(void)
+{
+    swizzle = swizzle_c;
+#ifdef HAVE_X86_SIMD
+    if (cpu_has(CPU_AVX2))
+	swizzle = swizzle_avx2;
+    else if (cpu_has(CPU_SSSE3))
+	swizzle = swizzle_ssse3;
+#endif
+}
+
+
+/* Reorder the bytes of n 32 bit pixels from src into dst (which may */
+/* be src), as described for SwizzleFn.                              */
+void swizzle32(Uint8* dst, const Uint8* src, int n, const Uint8* idx, const Uint8* fill)
+{
+    if (!swizzle)
+	pick_swizzle_kernels();
+    swizzle(dst, src, n, idx, fill);
+}
+
+
+
+/*************************************************/
+/* Compositing of premultiplied 32 bit surfaces  */
+/*************************************************/
+
+/* dst = src + dst * (255 - a) / 255, a byte at a time, where a is  */
+/* the alpha byte of the src pixel, at bit ashift. That is all "over" */
+/* compositing takes once src has its colors multiplied by its alpha. */
+/* x * y / 255 is rounded exactly, as (t + (t >> 8)) >> 8 with          */
+/* t = x * y + 128, so opaque and clear pixels come out unchanged.      */
+typedef void (*OverSpanFn)(Uint32* dst, const Uint32* src, int n, int ashift);
+
+static OverSpanFn over_span = NULL;
+
+static void over_span_c(Uint32* dst, const Uint32* src, int n, int ashift)
+{
+    const Uint8* s;
+    Uint8* d;
+    int i, c, inv, t;
+
+    for (i = 0; i < n; i++)
+    {
+	inv = 255 - ((src[i] >> ashift) & 0xff);
+	if (inv == 0)
+	{
+	    dst[i] = src[i];
+	    continue;
+	}
+	s = (const Uint8*)(src + i);
+	d = (Uint8*)(dst + i);
+	for (c = 0; c < 4; c++)
+	{
+	    t = d[c] * inv + 128;
+	    t = s[c] + ((t + (t >> 8)) >> 8);
+	    d[c] = (t > 255) ? 255 : t;
+	}
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+TARGET("sse2")
+static void over_span_sse2(Uint32* dst, const Uint32* src, int n, int ashift)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i ff = _mm_set1_epi16(255);
+    __m128i half = _mm_set1_epi16(128);
+    __m128i byte = _mm_set1_epi32(0xff);
+    __m128i sh = _mm_cvtsi32_si128(ashift);
+    __m128i s, d, a, lo, hi;
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+	s = _mm_loadu_si128((const __m128i*)(src + i));
+	d = _mm_loadu_si128((const __m128i*)(dst + i));
+	/* each pixel's alpha in both of its 16 bit halves: */
+	a = _mm_and_si128(_mm_srl_epi32(s, sh), byte);
+	a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+	lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(ff, _mm_unpacklo_epi32(a, a)));
+	hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(ff, _mm_unpackhi_epi32(a, a)));
+	lo = _mm_add_epi16(lo, half);
+	hi = _mm_add_epi16(hi, half);
+	lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+	hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+	_mm_storeu_si128((__m128i*)(dst + i), _mm_adds_epu8(_mm_packus_epi16(lo, hi), s));
+    }
+    over_span_c(dst + i, src + i, n - i, ashift);
+}
+
+TARGET("avx2")
+static void over_span_avx2(Uint32* dst, const Uint32* src, int n, int ashift)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i ff = _mm256_set1_epi16(255);
+    __m256i half = _mm256_set1_epi16(128);
+    __m256i byte = _mm256_set1_epi32(0xff);
+    __m128i sh = _mm_cvtsi32_si128(ashift);
+    __m256i s, d, a, lo, hi;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+	s = _mm256_loadu_si256((const __m256i*)(src + i));
+	d = _mm256_loadu_si256((const __m256i*)(dst + i));
+	a = _mm256_and_si256(_mm256_srl_epi32(s, sh), byte);
+	a = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+	lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero),
+		_mm256_sub_epi16(ff, _mm256_unpacklo_epi32(a, a)));
+	hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero),
+		_mm256_sub_epi16(ff, _mm256_unpackhi_epi32(a, a)));
+	lo = _mm256_add_epi16(lo, half);
+	hi = _mm256_add_epi16(hi, half);
+	lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+	hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+	_mm256_storeu_si256((__m256i*)(dst + i), _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), s));
+    }
+    over_span_sse2(dst + i, src + i, n - i, ashift);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+
+static void pick_over_kernels(void)
+{
+    over_span = over_span_c;
+#ifdef HAVE_X86_SIMD
+    if (cpu_has(CPU_AVX2))
+	over_span = over_span_avx2;
+    else if (cpu_has(CPU_SSE2))
+	over_span = over_span_sse2;
+#endif
+}
+
+
+/* Composite the rect sr of the premultiplied surface src over dst at */
+/* dr, which is the same size. Both must be 32 bit with the same color */
+/* masks, and dst's alpha (if it has any) where src's is; both must be */
+/* locked, and the rects must lie within them.                         */
+void over32(SDL_Surface* src, SDL_Rect* sr, SDL_Surface* dst, SDL_Rect* dr)
+{
+    int y;
+
+    if (!over_span)
+	pick_over_kernels();
+
+    for (y = 0; y < sr->h; y++)
+	over_span((Uint32*)((Uint8*)dst->pixels + (dr->y + y) * dst->pitch) + dr->x,
+		(const Uint32*)((Uint8*)src->pixels + (sr->y + y) * src->pitch) + sr->x,
+		sr->w, src->format->Ashift);
+}
+
+
+/* Choose all the kernels now, rather than on first use, and say which */
+/* ones we got.                                                         */
+void pick_kernels(void)
+{
+    pick_zoom_kernels();
+    pick_blend_kernels();
+    pick_flip_kernels();
+    pick_darken_kernels();
+    pick_swizzle_kernels();
+    pick_over_kernels();
+
+    DEBUGMSG(debug_sdl, "pick_kernels(): %s%s%s%s\n",
+	    cpu_has(CPU_SSE2) ? "SSE2 " : "",
+	    cpu_has(CPU_SSSE3) ? "SSSE3 " : "",
+	    cpu_has(CPU_AVX2) ? "AVX2 " : "",
+	    cpu_flags ? "" : "C only");
+}
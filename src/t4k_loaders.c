@@ -92,6 +92,10 @@ typedef struct
 } cachedSurface;
 
 #define CACHEDSURFACE_MAX 1000
+
+/* load_image() results also go in the scaled image cache (t4k_cache.c), */
+/* under a mode with this bit set if they were fitted into a box:        */
+#define IMG_CACHE_PROPORTIONAL 0x100
 int cacheSurface(const char* fn,SDL_Surface* surf);
 int getCachedSurface(const char* fn);
 SDL_Surface *IMG_Load_Cache(const char* fn);
@@ -99,6 +103,38 @@ SDL_Surface *IMG_Load_Cache(const char* fn);
 cachedSurface cached_surface[CACHEDSURFACE_MAX];
 int numSurfaces=0;
 
+/* structures related to sprite mip levels */
+/* The sprite struct is public (and games may make their own), so what  */
+/* we keep for a sprite lives in a hash table of our own, keyed by its */
+/* address. Each entry remembers the frame it was built from and holds */
+/* a reference on it, so a sprite freed without T4K_FreeSprite() and a */
+/* new one at the same address can't be mixed up: the frames differ.  */
+#define MAX_MIP_LEVELS 16
+#define SPRITE_PRIV_BUCKETS 64
+typedef struct spritePriv
+{
+    sprite* owner;
+    struct spritePriv* next;
+    /* src[i] is frame i (default_img for i == MAX_SPRITE_FRAMES) as it  */
+    /* was when the rest of [i] was built; NULL if nothing is built yet */
+    SDL_Surface* src[MAX_SPRITE_FRAMES + 1];
+    /* mips[i][l] is frame i at half the size of mips[i][l - 1]; */
+    /* level 0 is the frame itself                               */
+    SDL_Surface* mips[MAX_SPRITE_FRAMES + 1][MAX_MIP_LEVELS];
+    int num_mips[MAX_SPRITE_FRAMES + 1]; // highest level built so far
+    /* flips[i][X + 2 * Y - 1] is frame i flipped by T4K_Flip(img, X, Y) */
+    SDL_Surface* flips[MAX_SPRITE_FRAMES + 1][3];
+} spritePriv;
+
+static spritePriv* sprite_privs[SPRITE_PRIV_BUCKETS];
+
+static spritePriv** find_sprite_priv(sprite* s);
+static spritePriv* get_sprite_priv(sprite* s, int i, SDL_Surface* img);
+static void free_priv_frame(spritePriv* p, int i);
+static void free_sprite_priv(sprite* s);
+static SDL_Surface* scale_from_mips(sprite* s, int i, SDL_Surface* img, int w, int h);
+static SDL_Surface* cached_flip(sprite* s, int i, SDL_Surface* img, int X, int Y);
+
 
 
 //directories to search in for loaded files, in addition to common data dir (just one for now)
@@ -491,6 +527,7 @@ SDL_Surface* load_image(const char* file_name, int mode, int w, int h, bool prop
     char fn[T4K_PATH_MAX];
     int fn_len;
     int width = -1, height = -1;
+    int cache_mode;
     bool is_svg = true;
 
     if(NULL == file_name)
@@ -499,6 +536,15 @@ SDL_Surface* load_image(const char* file_name, int mode, int w, int h, bool prop
 	return NULL;
     }
 
+    /* IMG_NOT_REQUIRED doesn't change the picture, proportional does */
+    cache_mode = (mode & ~IMG_NOT_REQUIRED) | (proportional ? IMG_CACHE_PROPORTIONAL : 0);
+    final_pic = scale_cache_find(file_name, NULL, w, h, cache_mode);
+    if (final_pic)
+    {
+	DEBUGMSG(debug_loaders, "load_image(): using cached copy of %s\n", file_name);
+	return final_pic;
+    }
+
     /* run loader depending on file extension */
 
     /* add path prefix */
@@ -586,7 +632,8 @@ SDL_Surface* load_image(const char* file_name, int mode, int w, int h, bool prop
 	    width = w;
 	    height = h;
 	}
-	final_pic = T4K_zoom(loaded_pic, width, height);
+	/* (area averaging only differs from T4K_zoom() when shrinking) */
+	final_pic = T4K_zoomEx(loaded_pic, width, height, T4K_ZOOM_AREA);
 	SDL_FreeSurface(loaded_pic);
 	loaded_pic = final_pic;
 	final_pic = NULL;
@@ -594,6 +641,7 @@ SDL_Surface* load_image(const char* file_name, int mode, int w, int h, bool prop
 
     final_pic = set_format(loaded_pic, mode);
     SDL_FreeSurface(loaded_pic);
+    scale_cache_add(file_name, NULL, w, h, cache_mode, final_pic);
     DEBUGMSG(debug_loaders, "Leaving load_image()\n\n");
 
     return final_pic;
@@ -630,6 +678,15 @@ SDL_Surface* set_format(SDL_Surface* img, int mode)
 		return SDL_DisplayFormatAlpha(img);
 	    }
 
+	case IMG_PREMULTIPLIED:
+	    {
+		DEBUGMSG(debug_loaders, "set_format(): handling IMG_PREMULTIPLIED mode.\n");
+		img = SDL_DisplayFormatAlpha(img);
+		if (img)
+		    T4K_PremultiplyAlpha(img);
+		return img;
+	    }
+
 	case IMG_COLORKEY:
 	    {
 		DEBUGMSG(debug_loaders, "set_format(): handling IMG_COLORKEY mode.\n");
@@ -665,11 +722,14 @@ SDL_Surface* T4K_LoadBkgd(const char* file_name, int width, int height)
 	return NULL;
     }
 
-    /* turn off transparency, since it's the background */
-    SDL_SetAlpha(orig, SDL_RLEACCEL, SDL_ALPHA_OPAQUE);
     final_pic = SDL_DisplayFormat(orig); /* optimize the format */
     SDL_FreeSurface(orig);
 
+    /* turn off transparency, since it's the background - on our own */
+    /* copy, as orig may be shared through the scaled image cache     */
+    if (final_pic)
+	SDL_SetAlpha(final_pic, SDL_RLEACCEL, SDL_ALPHA_OPAQUE);
+
     return final_pic;
 }
 
@@ -847,16 +907,197 @@ sprite* T4K_FlipSprite(sprite* in, int X, int Y)
         return NULL;
 
     out = malloc(sizeof(sprite));
-    if (in->default_img != NULL)
-	out->default_img = T4K_Flip( in->default_img, X, Y );
-    else
-	out->default_img = NULL;
+    if (out == NULL)
+        return NULL;
+
+    /* the frames are shared with in's cache, one reference each: */
+    out->default_img = cached_flip(in, MAX_SPRITE_FRAMES, in->default_img, X, Y);
+    if (out->default_img != NULL)
+	out->default_img->refcount++;
+    for( out->num_frames=0; out->num_frames<in->num_frames; out->num_frames++ )
+    {
+	out->frame[out->num_frames] = cached_flip(in, out->num_frames, in->frame[out->num_frames], X, Y);
+	if (out->frame[out->num_frames] != NULL)
+	    out->frame[out->num_frames]->refcount++;
+    }
+    out->cur = 0;
+    return out;
+}
+
+SDL_Surface* T4K_GetFlippedFrame(sprite* s, int frame, int X, int Y)
+{
+    if (s == NULL || frame >= s->num_frames)
+        return NULL;
+
+    if (frame < 0)
+	return cached_flip(s, MAX_SPRITE_FRAMES, s->default_img, X, Y);
+    return cached_flip(s, frame, s->frame[frame], X, Y);
+}
+
+sprite* T4K_ScaleSprite(sprite* in, int w, int h)
+{
+    sprite *out;
+
+    if (in == NULL || w < 1 || h < 1)
+        return NULL;
+
+    out = malloc(sizeof(sprite));
+    if (out == NULL)
+        return NULL;
+
+    out->default_img = scale_from_mips(in, MAX_SPRITE_FRAMES, in->default_img, w, h);
     for( out->num_frames=0; out->num_frames<in->num_frames; out->num_frames++ )
-	out->frame[out->num_frames] = T4K_Flip( in->frame[out->num_frames], X, Y );
+	out->frame[out->num_frames] = scale_from_mips(in, out->num_frames, in->frame[out->num_frames], w, h);
     out->cur = 0;
     return out;
 }
 
+/* scale_from_mips : scale frame i of s (img) to w x h, starting from the */
+/* smallest mip level that is still at least that big. Levels are made as */
+/* they are first needed and kept until the sprite is freed.              */
+static SDL_Surface* scale_from_mips(sprite* s, int i, SDL_Surface* img, int w, int h)
+{
+    spritePriv* p;
+    SDL_Surface* level = img;
+    SDL_Surface* out;
+    int l;
+
+    if (!img)
+	return NULL;
+
+    p = get_sprite_priv(s, i, img);
+    for (l = 1; p && l < MAX_MIP_LEVELS; l++)
+    {
+	if (level->w / 2 < w || level->h / 2 < h)
+	    break;
+	if (l > p->num_mips[i])
+	{
+	    p->mips[i][l] = T4K_zoomEx(level, level->w / 2, level->h / 2, T4K_ZOOM_AREA);
+	    if (!p->mips[i][l])
+		break;
+	    p->num_mips[i] = l;
+	    DEBUGMSG(debug_loaders, "scale_from_mips(): built %dx%d level of frame %d\n",
+		    p->mips[i][l]->w, p->mips[i][l]->h, i);
+	}
+	level = p->mips[i][l];
+    }
+
+    out = T4K_zoomEx(level, w, h, T4K_ZOOM_AREA);
+
+    /* T4K_zoomEx() keeps the flags but not the key or alpha values: */
+    if (out && (img->flags & SDL_SRCCOLORKEY))
+	SDL_SetColorKey(out, img->flags & (SDL_SRCCOLORKEY | SDL_RLEACCEL), img->format->colorkey);
+    if (out && (img->flags & SDL_SRCALPHA) && !img->format->Amask)
+	SDL_SetAlpha(out, img->flags & (SDL_SRCALPHA | SDL_RLEACCEL), img->format->alpha);
+    return out;
+}
+
+/* cached_flip : frame i of s (img) flipped, made the first time it is */
+/* asked for and kept until the sprite is freed, which holds the only  */
+/* reference. Returns NULL if we run out of memory.                    */
+static SDL_Surface* cached_flip(sprite* s, int i, SDL_Surface* img, int X, int Y)
+{
+    spritePriv* p;
+    int f;
+
+    if (!img || (!X && !Y))
+	return img;
+
+    f = (X ? 1 : 0) + (Y ? 2 : 0) - 1;
+    p = get_sprite_priv(s, i, img);
+    if (!p)
+	return NULL;
+
+    if (!p->flips[i][f])
+    {
+	p->flips[i][f] = T4K_Flip(img, X, Y);
+	DEBUGMSG(debug_loaders, "cached_flip(): flipped frame %d (%d, %d)\n", i, X, Y);
+    }
+    return p->flips[i][f];
+}
+
+/* find_sprite_priv : where the table points to s's data (or to */
+/* the NULL at the end of its bucket, if it has none)            */
+static spritePriv** find_sprite_priv(sprite* s)
+{
+    spritePriv** p = &sprite_privs[((size_t)s >> 4) % SPRITE_PRIV_BUCKETS];
+
+    while (*p && (*p)->owner != s)
+	p = &(*p)->next;
+    return p;
+}
+
+/* get_sprite_priv : our data for a sprite, allocated on first use, */
+/* with whatever was built from frame i dropped if that isn't img   */
+/* any more. Returns NULL if we're out of memory.                   */
+static spritePriv* get_sprite_priv(sprite* s, int i, SDL_Surface* img)
+{
+    spritePriv** pp = find_sprite_priv(s);
+    spritePriv* p = *pp;
+
+    if (!p)
+    {
+	p = calloc(1, sizeof(spritePriv));
+	if (!p)
+	    return NULL;
+	p->owner = s;
+	*pp = p;
+    }
+    if (p->src[i] != img)
+    {
+	free_priv_frame(p, i);
+	p->src[i] = img;
+	img->refcount++;
+    }
+    return p;
+}
+
+/* free_priv_frame : drop what we built from frame i, and our */
+/* reference on the frame                                     */
+static void free_priv_frame(spritePriv* p, int i)
+{
+    int l;
+
+    for (l = 1; l <= p->num_mips[i]; l++)
+	SDL_FreeSurface(p->mips[i][l]);
+    p->num_mips[i] = 0;
+    for (l = 0; l < 3; l++)
+    {
+	if (p->flips[i][l])
+	    SDL_FreeSurface(p->flips[i][l]);
+	p->flips[i][l] = NULL;
+    }
+    if (p->src[i])
+	SDL_FreeSurface(p->src[i]);
+    p->src[i] = NULL;
+}
+
+static void free_sprite_priv(sprite* s)
+{
+    spritePriv** pp = find_sprite_priv(s);
+    spritePriv* p = *pp;
+    int i;
+
+    if (!p)
+	return;
+
+    for (i = 0; i <= MAX_SPRITE_FRAMES; i++)
+	free_priv_frame(p, i);
+    *pp = p->next;
+    free(p);
+}
+
+/* free_sprite_privs : drop the data of every sprite, */
+/* at CleanupT4KCommon() time                         */
+void free_sprite_privs(void)
+{
+    int b;
+
+    for (b = 0; b < SPRITE_PRIV_BUCKETS; b++)
+	while (sprite_privs[b])
+	    free_sprite_priv(sprite_privs[b]->owner);
+}
+
 void T4K_FreeSprite(sprite* gfx)
 {
     int x;
@@ -880,6 +1121,8 @@ void T4K_FreeSprite(sprite* gfx)
 	gfx->default_img = NULL;
     }
 
+    free_sprite_priv(gfx);
+
     DEBUGMSG(debug_loaders, "T4K_FreeSprite() - done\n");
     free(gfx);
 }
@@ -1043,10 +1286,7 @@ static int do_png_save(FILE * fi, const char *const fname, SDL_Surface * surf)
     png_infop info_ptr;
     png_text text_ptr[4];
     unsigned char **png_rows;
-    Uint8 r, g, b, a;
-    int x, y, count;
-    Uint32(*getpixel) (SDL_Surface *, int, int) =
-	getpixels[surf->format->BytesPerPixel];
+    int y, count;
 
 
     png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -1121,20 +1361,13 @@ static int do_png_save(FILE * fi, const char *const fname, SDL_Surface * surf)
 
 		png_rows = malloc(sizeof(char *) * surf->h);
 
+		SDL_LockSurface(surf);
 		for (y = 0; y < surf->h; y++)
 		{
 		    png_rows[y] = malloc(sizeof(char) * 4 * surf->w);
-
-		    for (x = 0; x < surf->w; x++)
-		    {
-			SDL_GetRGBA(getpixel(surf, x, y), surf->format, &r, &g, &b, &a);
-
-			png_rows[y][x * 4 + 0] = r;
-			png_rows[y][x * 4 + 1] = g;
-			png_rows[y][x * 4 + 2] = b;
-			png_rows[y][x * 4 + 3] = a;
-		    }
+		    read_span(surf, 0, y, surf->w, png_rows[y]);
 		}
+		SDL_UnlockSurface(surf);
 
 		png_write_image(png_ptr, png_rows);
 
@@ -87,6 +87,8 @@ int InitT4KCommon(int debug_flags)
     srand(SDL_GetTicks());
 
     debug_status = debug_flags;
+    /* Pixel kernels for this CPU: */
+    pick_kernels();
     T4K_InitBlitQueue();
     return 1;
 }
@@ -108,6 +110,14 @@ void CleanupT4KCommon(void)
     T4K_UnloadMenus();
     // Unload SDL_Pango or SDL_ttf:
     T4K_Cleanup_SDL_Text();
+    framestats_cleanup();
+    perfhud_free();
+    free_blit_queue();
+    free_corner_tables();
+    free_premultiplied();
+    scale_cache_free();
+    free_sprite_privs();
+    pool_shutdown();
     
 #ifdef HAVE_LIBSDL_NET
     /* Quit networking if appropriate: */
@@ -145,5 +155,12 @@ int T4K_HandleStdEvents (const SDL_Event* event)
     }
 #endif
 
+    /* Toggle performance HUD (the screen needs redrawing where it was): */
+    else if (key == SDLK_F12)
+    {
+	T4K_SetPerfHUD(!T4K_GetPerfHUD());
+	ret = 1;
+    }
+
     return ret;
 }
@@ -446,8 +446,7 @@ int T4K_RunMenu(int index, bool return_choice, void (*draw_background)(), int (*
 
     int action = NONE;
 
-    Uint32 frame_start = 0;       //For keeping frame rate constant
-    Uint32 frame_now = 0;
+    T4K_FrameScheduler frame_sched; //For keeping frame rate constant
     Uint32 frame_counter = 0;
     //int loc = -1;                  //The currently selected menu item
     int loc = 0;                  //Start with focus on first item
@@ -517,10 +516,9 @@ int T4K_RunMenu(int index, bool return_choice, void (*draw_background)(), int (*
 	/******** Main loop: *********/
 	stop = false;
 	DEBUGMSG(debug_menu, "run_menu(): entering menu loop\n");
+	T4K_InitFrameScheduler(&frame_sched, MAX_FPS, 0);
 	while (!stop)
 	{
-	    frame_start = SDL_GetTicks();         /* For keeping frame rate constant.*/
-
 	    action = NONE;
 	    while (!stop && (SDL_PollEvent(&event) || first_loop))
 	    {
@@ -1069,11 +1067,7 @@ int T4K_RunMenu(int index, bool return_choice, void (*draw_background)(), int (*
 	    }
 
 	    /* Wait so we keep frame rate constant: */
-	    frame_now = SDL_GetTicks();
-	    if (frame_now < frame_start)
-		frame_start = frame_now;  // in case the timer wraps around
-	    if((frame_now - frame_start) < 1000 / MAX_FPS)
-		SDL_Delay(1000 / MAX_FPS - (frame_now - frame_start));
+	    T4K_FrameWait(&frame_sched);
 
 	    frame_counter++;
 	} // End of while(!stop) loop
@@ -1102,9 +1096,13 @@ void prerender_panel() {
 	T4K_GetScreen()->h * desc_panel_pos[3]};
     if(desc_panel != NULL)
 	SDL_FreeSurface(desc_panel);
-    desc_panel = T4K_CreateButton(panelclip.w - panelclip.x, panelclip.h - panelclip.y, 8, 0xff, 0xff, 0xff, 100);
-    SDL_BlitSurface(desc_panel, NULL, T4K_GetScreen(), &panelclip);
-    SDL_BlitSurface(T4K_GetScreen(), &panelclip, desc_panel, NULL);
+    panelclip.w -= panelclip.x;
+    panelclip.h -= panelclip.y;
+    T4K_FillRoundedRect(T4K_GetScreen(), &panelclip, 8, 0xff, 0xff, 0xff, 100);
+    desc_panel = SDL_CreateRGBSurface(SDL_SWSURFACE|SDL_SRCALPHA, panelclip.w, panelclip.h,
+	    32, rmask, gmask, bmask, amask);
+    if(desc_panel != NULL)
+	SDL_BlitSurface(T4K_GetScreen(), &panelclip, desc_panel, NULL);
 }
 
 /* return button surfaces that are currently displayed (without sprites) */
@@ -1135,9 +1133,9 @@ SDL_Surface** render_buttons(MenuNode* menu, bool selected)
 	SDL_BlitSurface(T4K_GetScreen(), &curr_rect, menu_items[i], NULL);
 	/* button */
 	if(selected)
-	    tmp_surf = T4K_CreateButton(curr_rect.w, curr_rect.h, button_radius * curr_rect.h, SEL_RGBA);
+	    tmp_surf = T4K_GetButton(curr_rect.w, curr_rect.h, button_radius * curr_rect.h, SEL_RGBA);
 	else
-	    tmp_surf = T4K_CreateButton(curr_rect.w, curr_rect.h, button_radius * curr_rect.h, REG_RGBA);
+	    tmp_surf = T4K_GetButton(curr_rect.w, curr_rect.h, button_radius * curr_rect.h, REG_RGBA);
 
 	SDL_BlitSurface(tmp_surf, NULL, menu_items[i], NULL);
 	SDL_FreeSurface(tmp_surf);
@@ -0,0 +1,220 @@
+/*
+   t4k_perfhud.c
+
+   An on-screen performance display ("HUD"), toggled with F12 through
+   T4K_HandleStdEvents(). It shows the frame rate and frame times, a
+   graph of recent frames, blits per frame, and how often the surface
+   and font caches are hit, drawn through the blit queue on a layer of
+   its own that is only redrawn when the numbers change.
+
+   Copyright 2010.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+t4k_perfhud.c is part of the t4k_common library.
+
+t4k_common is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+t4k_common is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "t4k_common.h"
+#include "t4k_globals.h"
+#include "SDL.h"
+
+#define HUD_W 160
+#define HUD_LINES 4
+#define HUD_FONT_SIZE 10
+#define HUD_LINE_H (HUD_FONT_SIZE + 4)
+#define HUD_GRAPH_H 32
+#define HUD_H (HUD_LINES * HUD_LINE_H + HUD_GRAPH_H + 6)
+#define HUD_MARGIN 4
+#define HUD_INTERVAL 500    // msec between looks at the numbers
+#define HUD_GRAPH_MS 50     // frame time at the top of the graph
+
+static int hud_on = 0;
+static SDL_Surface* hud_surf = NULL;
+static Uint32 hud_last_look = 0;
+static char hud_text[HUD_LINES][64];
+/* the text cache lookups the HUD made drawing itself, */
+/* which are left out of the "fonts" figure            */
+static unsigned long hud_font_hits = 0, hud_font_misses = 0;
+
+static void draw_hud(Uint32* frame_us, int n);
+static int percent(unsigned long hits, unsigned long misses);
+
+
+
+/* Turn the HUD on or off */
+void T4K_SetPerfHUD(int on)
+{
+    hud_on = on;
+    DEBUGMSG(debug_sdl, "T4K_SetPerfHUD(): HUD %s\n", on ? "on" : "off");
+
+    if (on)
+    {
+	T4K_SetLayerRetained(T4K_LAYER_PERF, 1);
+	hud_last_look = 0;
+	memset(hud_text, 0, sizeof(hud_text));
+	return;
+    }
+
+    /* whatever was under it has to be redrawn by the game: */
+    T4K_ClearLayer(T4K_LAYER_PERF);
+    if (hud_surf)
+	SDL_FreeSurface(hud_surf);
+    hud_surf = NULL;
+}
+
+
+int T4K_GetPerfHUD(void)
+{
+    return hud_on;
+}
+
+
+/* Called by T4K_UpdateScreen() before it draws anything. Every    */
+/* HUD_INTERVAL msec, see if the numbers have changed, and if they */
+/* have, draw the HUD again and queue it.                          */
+void perfhud_update(void)
+{
+    Uint32 frame_us[HUD_W];
+    T4K_FrameStats stats;
+    unsigned long hits, misses, font_hits, font_misses;
+    unsigned long hits0, misses0;
+    char text[HUD_LINES][64];
+    double total = 0;
+    Uint32 now;
+    int i, n;
+
+    if (!hud_on || !screen)
+	return;
+
+    now = SDL_GetTicks();
+    if (hud_surf && now - hud_last_look < HUD_INTERVAL)
+	return;
+    hud_last_look = now;
+
+    n = framestats_recent(frame_us, HUD_W);
+    for (i = 0; i < n; i++)
+	total += frame_us[i];
+    T4K_GetFrameStats(&stats);
+    cache_stats(&hits, &misses);
+    text_cache_stats(&font_hits, &font_misses);
+    font_hits -= hud_font_hits;
+    font_misses -= hud_font_misses;
+
+    snprintf(text[0], 64, "%.0f fps  %.1f / %.1f ms",
+	    total > 0 ? n * 1000000.0 / total : 0.0, stats.frame_ms[0], stats.frame_ms[2]);
+    snprintf(text[1], 64, "cpu %.1f / %.1f ms  late %d",
+	    stats.cpu_ms[0], stats.cpu_ms[2], stats.overruns);
+    snprintf(text[2], 64, "%.0f blits  %.0fk px  %.0fk upd",
+	    stats.blits, stats.pixels / 1000, stats.update_area / 1000);
+    snprintf(text[3], 64, "cache %d%%  fonts %d%%",
+	    percent(hits, misses), percent(font_hits, font_misses));
+
+    if (hud_surf && !memcmp(text, hud_text, sizeof(text)))
+	return;
+    memcpy(hud_text, text, sizeof(text));
+
+    /* (in the screen's format, as the screen can change on a res switch) */
+    if (hud_surf && hud_surf->format->BitsPerPixel != screen->format->BitsPerPixel)
+    {
+	T4K_ClearLayer(T4K_LAYER_PERF);
+	SDL_FreeSurface(hud_surf);
+	hud_surf = NULL;
+    }
+    if (!hud_surf)
+    {
+	hud_surf = SDL_CreateRGBSurface(SDL_SWSURFACE, HUD_W, HUD_H,
+		screen->format->BitsPerPixel, screen->format->Rmask,
+		screen->format->Gmask, screen->format->Bmask, 0);
+	if (!hud_surf)
+	    return;
+    }
+
+    text_cache_stats(&hits0, &misses0);
+    draw_hud(frame_us, n);
+    text_cache_stats(&font_hits, &font_misses);
+    hud_font_hits += font_hits - hits0;
+    hud_font_misses += font_misses - misses0;
+
+    T4K_ClearLayer(T4K_LAYER_PERF);
+    T4K_DrawObjectOnLayer(hud_surf, screen->w - HUD_W - HUD_MARGIN, HUD_MARGIN,
+	    T4K_LAYER_PERF);
+}
+
+
+void perfhud_free(void)
+{
+    if (hud_surf)
+	SDL_FreeSurface(hud_surf);
+    hud_surf = NULL;
+    hud_on = 0;
+}
+
+
+
+/* The text, then a bar for each of the last n frames, newest on the */
+/* right: green if it kept up with MAX_FPS, red if not.              */
+static void draw_hud(Uint32* frame_us, int n)
+{
+    SDL_Color white = {0xff, 0xff, 0xff};
+    Uint32 green = SDL_MapRGB(hud_surf->format, 0x40, 0xd0, 0x40);
+    Uint32 red = SDL_MapRGB(hud_surf->format, 0xe0, 0x40, 0x40);
+    Uint32 target_us = 1000000 / MAX_FPS;
+    SDL_Surface* s;
+    SDL_Rect r;
+    int i, h;
+
+    SDL_FillRect(hud_surf, NULL, SDL_MapRGB(hud_surf->format, 0x20, 0x20, 0x20));
+
+    for (i = 0; i < HUD_LINES; i++)
+    {
+	s = T4K_SimpleText(hud_text[i], HUD_FONT_SIZE, &white);
+	if (!s)
+	    continue;
+	r.x = 4;
+	r.y = 2 + i * HUD_LINE_H;
+	SDL_BlitSurface(s, NULL, hud_surf, &r);
+	SDL_FreeSurface(s);
+    }
+
+    /* a line where a frame takes as long as it may: */
+    r.x = 0;
+    r.y = HUD_H - 2 - HUD_GRAPH_H * target_us / (HUD_GRAPH_MS * 1000);
+    r.w = HUD_W;
+    r.h = 1;
+    SDL_FillRect(hud_surf, &r, SDL_MapRGB(hud_surf->format, 0x60, 0x60, 0x60));
+
+    for (i = 0; i < n; i++)
+    {
+	h = frame_us[i] * HUD_GRAPH_H / (HUD_GRAPH_MS * 1000);
+	if (h > HUD_GRAPH_H)
+	    h = HUD_GRAPH_H;
+	if (h < 1)
+	    h = 1;
+	r.x = HUD_W - n + i;
+	r.y = HUD_H - 2 - h;
+	r.w = 1;
+	r.h = h;
+	SDL_FillRect(hud_surf, &r, frame_us[i] > target_us ? red : green);
+    }
+}
+
+
+static int percent(unsigned long hits, unsigned long misses)
+{
+    if (hits + misses == 0)
+	return 0;
+    return 100.0 * hits / (hits + misses) + 0.5;
+}
@@ -259,3 +259,184 @@ void (*putpixels[]) (SDL_Surface *, int, int, Uint32) =
 Uint32(*getpixels[])(SDL_Surface *, int, int) =
 {
     getpixel8, getpixel8, getpixel16, getpixel24, getpixel32};
+
+
+/* Row and span access: whole runs of pixels converted to and from */
+/* R, G, B, A bytes, so pixel code can work on plain memory instead */
+/* of calling getpixel()/putpixel() and SDL_GetRGBA() per pixel.   */
+
+/* Which byte (in memory) of a 32 bit pixel is the channel with */
+/* mask m, or -1 if it isn't a whole byte                       */
+static int mask_byte(Uint32 m)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+	if (m == (Uint32) 0xff << (i * 8))
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	    return 3 - i;
+#else
+	    return i;
+#endif
+    return -1;
+}
+
+/* If the pixels of f are 4 bytes, one per channel, put the bytes  */
+/* R, G, B and A are in into pos (0x80 for A if there isn't one) */
+/* and return 1; this covers nearly every surface we ever see.    */
+static int byte_layout(SDL_PixelFormat * f, Uint8 * pos)
+{
+    int i, b;
+
+    if (f->BytesPerPixel != 4)
+	return 0;
+    for (i = 0; i < 4; i++)
+    {
+	if (i == 3 && !f->Amask)
+	{
+	    pos[3] = 0x80;
+	    break;
+	}
+	b = mask_byte(i == 0 ? f->Rmask : i == 1 ? f->Gmask : i == 2 ? f->Bmask : f->Amask);
+	if (b < 0)
+	    return 0;
+	pos[i] = b;
+    }
+    return 1;
+}
+
+/* A channel of pixel scaled up to 8 bits the same way SDL_GetRGBA() */
+/* does it, by copying its top bits into the ones that were lost.    */
+static inline Uint8 channel(Uint32 pixel, Uint32 mask, int shift, int loss)
+{
+    Uint32 v = (pixel & mask) >> shift;
+
+    if (loss >= 8)
+	return 0;
+    return (v << loss) + (loss <= 4 ? v >> (8 - (loss << 1)) : 0);
+}
+
+static inline Uint32 load_pixel(Uint8 * p, int bpp)
+{
+    switch (bpp)
+    {
+	case 1:
+	    return *p;
+	case 2:
+	    return *(Uint16 *) p;
+	case 3:
+	    if (SDL_BYTEORDER == SDL_BIG_ENDIAN)
+		return p[0] << 16 | p[1] << 8 | p[2];
+	    return p[0] | p[1] << 8 | p[2] << 16;
+	default:
+	    return *(Uint32 *) p;
+    }
+}
+
+static inline void store_pixel(Uint8 * p, int bpp, Uint32 pixel)
+{
+    switch (bpp)
+    {
+	case 1:
+	    *p = pixel;
+	    break;
+	case 2:
+	    *(Uint16 *) p = pixel;
+	    break;
+	case 3:
+	    if (SDL_BYTEORDER == SDL_BIG_ENDIAN)
+	    {
+		p[0] = (pixel >> 16) & 0xff;
+		p[1] = (pixel >> 8) & 0xff;
+		p[2] = pixel & 0xff;
+	    }
+	    else
+	    {
+		p[0] = pixel & 0xff;
+		p[1] = (pixel >> 8) & 0xff;
+		p[2] = (pixel >> 16) & 0xff;
+	    }
+	    break;
+	default:
+	    *(Uint32 *) p = pixel;
+	    break;
+    }
+}
+
+/* Read n pixels of row y of s, starting at x, into rgba as R, G, B, A */
+/* bytes, with the same values SDL_GetRGBA() would give. s must be    */
+/* locked, and the span must lie within it.                            */
+void read_span(SDL_Surface * s, int x, int y, int n, Uint8 * rgba)
+{
+    SDL_PixelFormat *f = s->format;
+    Uint8 *p = (Uint8 *) s->pixels + y * s->pitch + x * f->BytesPerPixel;
+    Uint8 pos[4], fill[4] = {0, 0, 0, 0};
+    SDL_Color *c;
+    Uint32 pixel;
+    int i;
+
+    if (byte_layout(f, pos))
+    {
+	if (pos[3] == 0x80)
+	    fill[3] = 0xff;
+	swizzle32(rgba, p, n, pos, fill);
+	return;
+    }
+
+    if (f->palette)
+    {
+	for (i = 0; i < n; i++, rgba += 4)
+	{
+	    c = &f->palette->colors[p[i]];
+	    rgba[0] = c->r;
+	    rgba[1] = c->g;
+	    rgba[2] = c->b;
+	    rgba[3] = 0xff;
+	}
+	return;
+    }
+
+    for (i = 0; i < n; i++, p += f->BytesPerPixel, rgba += 4)
+    {
+	pixel = load_pixel(p, f->BytesPerPixel);
+	rgba[0] = channel(pixel, f->Rmask, f->Rshift, f->Rloss);
+	rgba[1] = channel(pixel, f->Gmask, f->Gshift, f->Gloss);
+	rgba[2] = channel(pixel, f->Bmask, f->Bshift, f->Bloss);
+	rgba[3] = f->Amask ? channel(pixel, f->Amask, f->Ashift, f->Aloss) : 0xff;
+    }
+}
+
+/* Write n pixels of R, G, B, A bytes from rgba into row y of s,  */
+/* starting at x, as SDL_MapRGBA() would map them. s must be       */
+/* locked, and the span must lie within it.                        */
+void write_span(SDL_Surface * s, int x, int y, int n, const Uint8 * rgba)
+{
+    SDL_PixelFormat *f = s->format;
+    Uint8 *p = (Uint8 *) s->pixels + y * s->pitch + x * f->BytesPerPixel;
+    Uint8 pos[4], idx[4], fill[4] = {0, 0, 0, 0};
+    Uint32 pixel;
+    int i;
+
+    if (byte_layout(f, pos))
+    {
+	/* the other way round: where each byte of the pixel comes from */
+	idx[0] = idx[1] = idx[2] = idx[3] = 0x80;
+	for (i = 0; i < 4; i++)
+	    if (pos[i] < 4)
+		idx[pos[i]] = i;
+	swizzle32(p, rgba, n, idx, fill);
+	return;
+    }
+
+    for (i = 0; i < n; i++, p += f->BytesPerPixel, rgba += 4)
+    {
+	if (f->palette)
+	    pixel = SDL_MapRGBA(f, rgba[0], rgba[1], rgba[2], rgba[3]);
+	else
+	    pixel = (Uint32) (rgba[0] >> f->Rloss) << f->Rshift
+		| (Uint32) (rgba[1] >> f->Gloss) << f->Gshift
+		| (Uint32) (rgba[2] >> f->Bloss) << f->Bshift
+		| (((Uint32) (rgba[3] >> f->Aloss) << f->Ashift) & f->Amask);
+	store_pixel(p, f->BytesPerPixel, pixel);
+    }
+}
@@ -47,6 +47,34 @@ int fs_res_y = 0;
 
 const char* _font_name = DEFAULT_FONT_NAME;
 
+/* set to skip the fast 32 bit paths and use the generic code */
+static int reference_kernels = 0;
+
+/* how many pixels the generic code converts with read_span() at once */
+#define SPAN_CHUNK 256
+
+/* Surfaces from T4K_PremultiplyAlpha(), and those T4K_Flip(),       */
+/* T4K_zoom() and T4K_zoomEx() make from them, are kept in this set,   */
+/* so the blit queue knows to composite them itself. The set holds a   */
+/* reference on each, so a freed one's address can't come back as a    */
+/* different surface; surfaces nobody else holds any more are dropped  */
+/* by T4K_UpdateScreen(), and whenever the set has grown to twice its  */
+/* size after the last sweep (for games that never call it).           */
+#define PREMULTIPLIED_BUCKETS 256
+typedef struct premulEntry
+{
+    SDL_Surface* surf;
+    struct premulEntry* next;
+} premulEntry;
+
+static premulEntry* premultiplied[PREMULTIPLIED_BUCKETS];
+static int num_premultiplied = 0;
+static int premultiplied_sweep_at = PREMULTIPLIED_BUCKETS;
+
+static int is_premultiplied(SDL_Surface* s);
+static void mark_premultiplied(SDL_Surface* s);
+static void sweep_premultiplied(int all);
+
 void T4K_SetFontName(const char* name)
 {
     DEBUGMSG(debug_sdl, "Switching font to %s\n", name);
@@ -58,6 +86,13 @@ const char* T4K_AskFontName()
     return _font_name;
 }
 
+void T4K_SetReferenceKernels(int on)
+{
+    reference_kernels = on;
+    DEBUGMSG(debug_sdl, "T4K_SetReferenceKernels(): %s paths\n",
+	    on ? "reference" : "fast");
+}
+
 /*
    Return a pointer to the screen we're using, as an alternative to making screen
    global. Not sure what is involved performance-wise in SDL_GetVideoSurface,
@@ -112,10 +147,10 @@ void T4K_DrawButtonOn(SDL_Surface* target,
 	Uint8 r, Uint8 g, Uint8 b, Uint8 a)
 
 {
-    SDL_Surface* tmp_surf = T4K_CreateButton(target_rect->w, target_rect->h,
-	    radius, r, g, b, a);
-    SDL_BlitSurface(tmp_surf, NULL, target, target_rect);
-    SDL_FreeSurface(tmp_surf);
+    SDL_Rect rect = *target_rect;
+
+    /* (like SDL_BlitSurface(), only the position is taken from target_rect) */
+    T4K_FillRoundedRect(target, &rect, radius, r, g, b, a);
 }
 
 
@@ -237,105 +272,265 @@ void T4K_RoundCorners(SDL_Surface* s, Uint16 radius)
     SDL_UnlockSurface(s);
 }
 
-/**********************
-Flip:
-input: a SDL_Surface, x, y
-output: a copy of the SDL_Surface flipped via rules:
+/* Corner coverage for T4K_FillRoundedRect(): for radius r, a table  */
+/* of r x r values (0 - 255) saying how much of each pixel of the top */
+/* left corner is inside the circle, made the first time r is used.   */
+#define MAX_CORNER_TABLES 128
+#define CORNER_SAMPLES 8
+static Uint8* corner_tables[MAX_CORNER_TABLES];
+
+static Uint8* make_corner_table(int r);
+static void fill_span(SDL_Surface* s, int y, int x0, int x1, Uint32 color,
+	Uint8 red, Uint8 green, Uint8 blue, int alpha);
+
+/* T4K_FillRoundedRect() draws a translucent rounded rectangle straight */
+/* onto target, a scanline at a time, with anti-aliased corners.        */
+/* Like blitting a T4K_CreateButton() surface, it leaves target's own   */
+/* alpha channel (if any) alone.                                        */
+void T4K_FillRoundedRect(SDL_Surface* target, SDL_Rect* rect, int radius,
+	Uint8 r, Uint8 g, Uint8 b, Uint8 a)
+{
+    Uint8* cov;
+    Uint32 color;
+    int x, y, dy, edge, alpha;
 
-if x is a nonzero value, then flip horizontally
-if y is a nonzero value, then flip vertically
+    if (!target || !rect || rect->w < 1 || rect->h < 1 || a == 0)
+	return;
 
-note: you can have it flip both
- **********************/
-SDL_Surface* T4K_Flip( SDL_Surface *in, int x, int y ) {
-    SDL_Surface *out, *tmp;
-    SDL_Rect from_rect, to_rect;
-    Uint32        flags;
-    Uint32  colorkey=0;
+    /* radius cannot be more than half of width or height: */
+    if (radius > rect->w / 2)
+	radius = rect->w / 2;
+    if (radius > rect->h / 2)
+	radius = rect->h / 2;
+    if (radius < 0)
+	radius = 0;
+
+    cov = NULL;
+    if (radius > 0)
+    {
+	if (radius < MAX_CORNER_TABLES)
+	{
+	    if (!corner_tables[radius])
+		corner_tables[radius] = make_corner_table(radius);
+	    cov = corner_tables[radius];
+	}
+	else
+	    cov = make_corner_table(radius);
+	if (!cov)
+	    radius = 0;
+    }
 
-    /* --- grab the settings for the incoming pixmap --- */
+    color = SDL_MapRGB(target->format, r, g, b);
+    alpha = a + (a >> 7);   // 0 - 256
 
-    SDL_LockSurface(in);
-    flags = in->flags;
+    if (SDL_LockSurface(target) == -1)
+    {
+	if (radius >= MAX_CORNER_TABLES)
+	    free(cov);
+	return;
+    }
+
+    for (y = 0; y < rect->h; y++)
+    {
+	/* rows within radius of the top or bottom are in the corners: */
+	dy = -1;
+	if (y < radius)
+	    dy = y;
+	else if (y >= rect->h - radius)
+	    dy = rect->h - 1 - y;
 
-    /* --- change in's flags so ignore colorkey & alpha --- */
+	if (dy < 0)
+	{
+	    fill_span(target, rect->y + y, rect->x, rect->x + rect->w, color, r, g, b, alpha);
+	    continue;
+	}
 
-    if (flags & SDL_SRCCOLORKEY) {
-	in->flags &= ~SDL_SRCCOLORKEY;
-	colorkey = in->format->colorkey;
+	/* partly covered pixels one at a time, the rest as one span: */
+	edge = 0;
+	for (x = 0; x < radius; x++)
+	{
+	    if (cov[dy * radius + x] == 255)
+		break;
+	    if (cov[dy * radius + x])
+	    {
+		fill_span(target, rect->y + y, rect->x + x, rect->x + x + 1, color, r, g, b,
+			(alpha * cov[dy * radius + x] + 127) / 255);
+		fill_span(target, rect->y + y, rect->x + rect->w - 1 - x, rect->x + rect->w - x,
+			color, r, g, b, (alpha * cov[dy * radius + x] + 127) / 255);
+	    }
+	    edge = x + 1;
+	}
+	fill_span(target, rect->y + y, rect->x + edge, rect->x + rect->w - edge, color, r, g, b, alpha);
     }
-    if (flags & SDL_SRCALPHA) {
-	in->flags &= ~SDL_SRCALPHA;
+
+    SDL_UnlockSurface(target);
+
+    if (radius >= MAX_CORNER_TABLES)
+	free(cov);
+}
+
+/* Free the corner tables made by T4K_FillRoundedRect() */
+void free_corner_tables(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_CORNER_TABLES; i++)
+    {
+	free(corner_tables[i]);
+	corner_tables[i] = NULL;
     }
+}
 
-    SDL_UnlockSurface(in);
+/* Coverage of the top left corner of radius r, by sampling each */
+/* pixel CORNER_SAMPLES x CORNER_SAMPLES times.                  */
+static Uint8* make_corner_table(int r)
+{
+    Uint8* t = malloc(r * r);
+    int x, y, i, j, n;
+    float sx, sy;
 
-    /* --- create our new surface --- */
+    if (!t)
+	return NULL;
 
-    out = SDL_CreateRGBSurface(
-	    SDL_SWSURFACE,
-	    in->w, in->h, 32, rmask, gmask, bmask, amask);
+    for (y = 0; y < r; y++)
+    {
+	for (x = 0; x < r; x++)
+	{
+	    n = 0;
+	    for (j = 0; j < CORNER_SAMPLES; j++)
+	    {
+		sy = r - (y + (j + 0.5) / CORNER_SAMPLES);
+		for (i = 0; i < CORNER_SAMPLES; i++)
+		{
+		    sx = r - (x + (i + 0.5) / CORNER_SAMPLES);
+		    if (sx * sx + sy * sy <= r * r)
+			n++;
+		}
+	    }
+	    t[y * r + x] = (n * 255 + CORNER_SAMPLES * CORNER_SAMPLES / 2)
+		/ (CORNER_SAMPLES * CORNER_SAMPLES);
+	}
+    }
+    return t;
+}
+
+/* Mix the color into pixels x0 to x1 - 1 of row y of s, with weight */
+/* alpha (0 - 256), within s's clip rect. s must be locked.          */
+static void fill_span(SDL_Surface* s, int y, int x0, int x1, Uint32 color,
+	Uint8 red, Uint8 green, Uint8 blue, int alpha)
+{
+    SDL_Rect* c = &s->clip_rect;
+    Uint8 buf[SPAN_CHUNK * 4];
+    int ai, i, n;
 
-    /* --- flip horizontally if requested --- */
+    if (y < c->y || y >= c->y + c->h || alpha <= 0)
+	return;
+    if (x0 < c->x)
+	x0 = c->x;
+    if (x1 > c->x + c->w)
+	x1 = c->x + c->w;
+    if (x0 >= x1)
+	return;
 
-    if (x) {
-	from_rect.h = to_rect.h = in->h;
-	from_rect.w = to_rect.w = 1;
-	from_rect.y = to_rect.y = 0;
-	from_rect.x = 0;
-	to_rect.x = in->w - 1;
+    if (s->format->BytesPerPixel == 4 && !reference_kernels)
+    {
+	ai = -1;
+	if (s->format->Amask)
+	{
+	    ai = s->format->Ashift / 8;
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	    ai = 3 - ai;
+#endif
+	}
+	fill_span32((Uint32*)((Uint8*)s->pixels + y * s->pitch) + x0, x1 - x0, color, alpha, ai,
+		s->format->Rmask | s->format->Gmask | s->format->Bmask | s->format->Amask);
+	return;
+    }
 
-	do {
-	    SDL_BlitSurface(in, &from_rect, out, &to_rect);
-	    from_rect.x++;
-	    to_rect.x--;
-	} while (to_rect.x >= 0);
+    for (; x0 < x1; x0 += n)
+    {
+	n = (x1 - x0 < SPAN_CHUNK) ? x1 - x0 : SPAN_CHUNK;
+	read_span(s, x0, y, n, buf);
+	for (i = 0; i < n * 4; i += 4)
+	{
+	    buf[i] = (buf[i] * (256 - alpha) + red * alpha) >> 8;
+	    buf[i + 1] = (buf[i + 1] * (256 - alpha) + green * alpha) >> 8;
+	    buf[i + 2] = (buf[i + 2] * (256 - alpha) + blue * alpha) >> 8;
+	}
+	write_span(s, x0, y, n, buf);
     }
+}
+
+/**********************
+Flip:
+input: a SDL_Surface, x, y
+output: a copy of the SDL_Surface flipped via rules:
+
+if x is a nonzero value, then flip horizontally
+if y is a nonzero value, then flip vertically
+
+note: you can have it flip both
+ **********************/
+SDL_Surface* T4K_Flip( SDL_Surface *in, int x, int y ) {
+    SDL_Surface *out;
+    Uint8 *from, *to;
+    int bpp, i, j;
 
-    /* --- flip vertically if requested --- */
+    if (!in)
+	return NULL;
 
-    if (y) {
-	from_rect.h = to_rect.h = 1;
-	from_rect.w = to_rect.w = in->w;
-	from_rect.x = to_rect.x = 0;
-	from_rect.y = 0;
-	to_rect.y = in->h - 1;
+    /* --- create our new surface, in the same format as in --- */
 
-	do {
-	    SDL_BlitSurface(in, &from_rect, out, &to_rect);
-	    from_rect.y++;
-	    to_rect.y--;
-	} while (to_rect.y >= 0);
+    out = SDL_CreateRGBSurface(
+	    SDL_SWSURFACE, in->w, in->h, in->format->BitsPerPixel,
+	    in->format->Rmask, in->format->Gmask,
+	    in->format->Bmask, in->format->Amask);
+    if (!out) {
+	fprintf(stderr, "T4K_Flip() - could not create surface: %s\n", SDL_GetError());
+	return NULL;
     }
+    if (in->format->palette)
+	SDL_SetColors(out, in->format->palette->colors, 0, in->format->palette->ncolors);
 
-    /* --- restore colorkey & alpha on in and setup out the same --- */
+    /* --- copy the pixels over, reversing rows and/or columns --- */
 
     SDL_LockSurface(in);
+    SDL_LockSurface(out);
 
-    if (flags & SDL_SRCCOLORKEY) {
-	in->flags |= SDL_SRCCOLORKEY;
-	in->format->colorkey = colorkey;
-	tmp = SDL_DisplayFormat(out);
-	SDL_FreeSurface(out);
-	out = tmp;
-	out->flags |= SDL_SRCCOLORKEY;
-	out->format->colorkey = colorkey;
-    } else if (flags & SDL_SRCALPHA) {
-	in->flags |= SDL_SRCALPHA;
-	tmp = SDL_DisplayFormatAlpha(out);
-	SDL_FreeSurface(out);
-	out = tmp;
+    bpp = in->format->BytesPerPixel;
+    if (bpp == 4 && !reference_kernels) {
+	flip32(in, out, x, y);
     } else {
-	tmp = SDL_DisplayFormat(out);
-	SDL_FreeSurface(out);
-	out = tmp;
+	for (j = 0; j < in->h; j++) {
+	    from = (Uint8*)in->pixels + (y ? in->h - 1 - j : j) * in->pitch;
+	    to = (Uint8*)out->pixels + j * out->pitch;
+	    if (!x)
+		memcpy(to, from, in->w * bpp);
+	    else
+		for (i = 0; i < in->w; i++)
+		    memcpy(to + i * bpp, from + (in->w - 1 - i) * bpp, bpp);
+	}
     }
 
+    SDL_UnlockSurface(out);
     SDL_UnlockSurface(in);
 
+    /* --- set up out's colorkey & alpha the same as in's --- */
+
+    if (in->flags & SDL_SRCCOLORKEY)
+	SDL_SetColorKey(out, in->flags & (SDL_SRCCOLORKEY | SDL_RLEACCEL), in->format->colorkey);
+    SDL_SetAlpha(out, in->flags & (SDL_SRCALPHA | SDL_RLEACCEL), in->format->alpha);
+    if (is_premultiplied(in))
+	mark_premultiplied(out);
+
     return out;
 }
 
+static void blend_surfaces(SDL_Surface* dst, SDL_Rect* r, SDL_Surface* s1, SDL_Surface* s2,
+	float gamma, int blend_alpha);
+static int same_format32(SDL_Surface* a, SDL_Surface* b);
+static int clip_blit(SDL_Surface* src, SDL_Rect* srcrect, SDL_Surface* dst, SDL_Rect* dstrect);
+
 /* Blend two surfaces together. The third argument is between 0.0 and
    1.0, and represents the weight assigned to the first surface.  If
    the pointer to the second surface is NULL, this performs fading.
@@ -346,16 +541,15 @@ SDL_Surface* T4K_Flip( SDL_Surface *in, int x, int y ) {
 SDL_Surface* T4K_Blend(SDL_Surface *S1, SDL_Surface *S2, float gamma)
 {
     SDL_PixelFormat *fmt1, *fmt2;
-    Uint8 r1, r2, g1, g2, b1, b2, a1, a2;
-    SDL_Surface *tmpS, *ret;
-    Uint32 *cpix1, *epix1, *cpix2, *epix2;
+    SDL_Surface *ret;
+    SDL_Rect rect;
     float gamflip;
 
     if (!S1)
 	return NULL;
 
     fmt1 = fmt2 = NULL;
-    tmpS = ret = NULL;
+    ret = NULL;
 
     gamflip = 1.0 - gamma;
     if (gamma < 0 || gamflip < 0)
@@ -389,61 +583,389 @@ SDL_Surface* T4K_Blend(SDL_Surface *S1, SDL_Surface *S2, float gamma)
 	}
     }
 
-    tmpS = SDL_ConvertSurface(S1, fmt1, SDL_SWSURFACE);
-    if (tmpS == NULL)
+    // Work straight on our copy of S1, already in the format we
+    // return. If S1 has no alpha, its copy is opaque and stays so.
+    ret = SDL_DisplayFormatAlpha(S1);
+    if (ret == NULL)
     {
-	perror("SDL_ConvertSurface() failed");
+	perror("SDL_DisplayFormatAlpha() failed");
 	return S1;
     }
-    if (-1 == SDL_LockSurface(tmpS))
+    if (-1 == SDL_LockSurface(ret))
     {
 	perror("SDL_LockSurface() failed");
+	SDL_FreeSurface(ret);
 	return S1;
     }
+    if (S2 != NULL && SDL_LockSurface(S2) == -1)
+	S2 = NULL;
+
+    rect.x = rect.y = 0;
+    rect.w = ret->w;
+    rect.h = ret->h;
+    blend_surfaces(ret, &rect, ret, S2, gamma, fmt1->Amask != 0);
+
+    SDL_UnlockSurface(ret);
+
+    if (S2 != NULL)
+	SDL_UnlockSurface(S2);
+
+    return ret;
+}
+
+
+/* T4K_BlendInto() : like T4K_Blend(), but writes the result into the  */
+/* rect r (NULL for all) of a surface the caller already has, such as */
+/* the screen, instead of allocating a new one. S1 and S2 are read at */
+/* the same coordinates as dst; dst may be S1 itself.                 */
+int T4K_BlendInto(SDL_Surface* dst, SDL_Surface* S1, SDL_Surface* S2, float gamma, SDL_Rect* r)
+{
+    SDL_Rect rect;
+    int x1, y1;
 
-    // We're going to go through the pixels in reverse order, to start
-    // from the bottom of each image. That way, we can blend things that
-    // are not of the same height and have them align at the bottom.
-    // So the "ending pixel" (epix) will be before the first pixel, and
-    // the current pixel (cpix) will be the last pixel.
-    epix1 = (Uint32*) tmpS->pixels - 1;
-    cpix1 = epix1 + tmpS->w * tmpS->h;
-    if (S2 != NULL
-	    && (SDL_LockSurface(S2) != -1))
+    if (!dst || !S1)
+	return 0;
+
+    if (gamma < 0 || gamma > 1)
+    {
+	fprintf(stderr, "T4K_BlendInto() - gamma must be between 0 and 1\n");
+	return 0;
+    }
+    if (S1->format->BitsPerPixel != 32
+	    || (S2 != NULL && S2->format->BitsPerPixel != 32))
+    {
+	fprintf(stderr, "T4K_BlendInto() - this works only with 32 bit images\n");
+	return 0;
+    }
+    if (S2 != NULL && S1->w != S2->w)
     {
-	epix2 = (Uint32*) S2->pixels - 1;
-	cpix2 = epix2 + S2->w * S2->h;
+	fprintf(stderr, "T4K_BlendInto() - both images must have the same width\n");
+	return 0;
     }
+
+    /* clip to what dst and S1 both have */
+    if (r)
+	rect = *r;
     else
     {
-	epix2 = epix1;
-	cpix2 = cpix1;
+	rect.x = rect.y = 0;
+	rect.w = dst->w;
+	rect.h = dst->h;
+    }
+    x1 = rect.x + rect.w;
+    y1 = rect.y + rect.h;
+    if (x1 > dst->w)
+	x1 = dst->w;
+    if (x1 > S1->w)
+	x1 = S1->w;
+    if (y1 > dst->h)
+	y1 = dst->h;
+    if (y1 > S1->h)
+	y1 = S1->h;
+    if (rect.x < 0)
+	rect.x = 0;
+    if (rect.y < 0)
+	rect.y = 0;
+    if (x1 <= rect.x || y1 <= rect.y)
+	return 1;
+    rect.w = x1 - rect.x;
+    rect.h = y1 - rect.y;
+
+    if (SDL_LockSurface(dst) == -1)
+    {
+	fprintf(stderr, "T4K_BlendInto() - SDL_LockSurface() failed: %s\n", SDL_GetError());
+	return 0;
+    }
+    if (S1 != dst)
+	SDL_LockSurface(S1);
+    if (S2 != NULL)
+	SDL_LockSurface(S2);
+
+    blend_surfaces(dst, &rect, S1, S2, gamma,
+	    S1->format->Amask != 0 && dst->format->Amask != 0);
+
+    if (S2 != NULL)
+	SDL_UnlockSurface(S2);
+    if (S1 != dst)
+	SDL_UnlockSurface(S1);
+    SDL_UnlockSurface(dst);
+
+    return 1;
+}
+
+
+/* dst = s1 * gamma + s2 * (1 - gamma) within r, bottom-aligned, as   */
+/* described for blend32(); this also handles dst or s2 being in a     */
+/* different format. The surfaces must be locked.                      */
+static void blend_surfaces(SDL_Surface* dst, SDL_Rect* r, SDL_Surface* s1, SDL_Surface* s2,
+	float gamma, int blend_alpha)
+{
+    Uint8 buf1[SPAN_CHUNK * 4], buf2[SPAN_CHUNK * 4];
+    Uint8 *c1, *c2;
+    float gamflip = 1.0 - gamma;
+    int x, y, y2, i, n;
+
+    if (!reference_kernels && same_format32(dst, s1) && (!s2 || same_format32(dst, s2)))
+    {
+	blend32(dst, r, s1, s2, gamma, blend_alpha);
+	return;
     }
 
-    for (; cpix1 > epix1; cpix1--, cpix2--)
+    // The old, generic way, a pixel at a time (but converted a span at a time):
+    for (y = r->y; y < r->y + r->h; y++)
     {
-	SDL_GetRGBA(*cpix1, fmt1, &r1, &g1, &b1, &a1);
-	a1 = gamma * a1;
-	if (S2 != NULL && cpix2 > epix2)
+	y2 = s2 ? y + s2->h - s1->h : -1;
+	if (y2 >= 0 && y2 >= s2->h)
+	    y2 = -1;
+
+	for (x = r->x; x < r->x + r->w; x += n)
 	{
-	    SDL_GetRGBA(*cpix2, fmt2, &r2, &g2, &b2, &a2);
-	    r1 = gamma * r1 + gamflip * r2;
-	    g1 = gamma * g1 + gamflip * g2;
-	    b1 = gamma * b1 + gamflip * b2;
-	    a1 += gamflip * a2;
+	    n = (r->x + r->w - x < SPAN_CHUNK) ? r->x + r->w - x : SPAN_CHUNK;
+	    read_span(s1, x, y, n, buf1);
+	    if (y2 >= 0)
+		read_span(s2, x, y2, n, buf2);
+
+	    for (i = 0, c1 = buf1, c2 = buf2; i < n; i++, c1 += 4, c2 += 4)
+	    {
+		if (blend_alpha)
+		    c1[3] = gamma * c1[3];
+		if (y2 >= 0)
+		{
+		    c1[0] = gamma * c1[0] + gamflip * c2[0];
+		    c1[1] = gamma * c1[1] + gamflip * c2[1];
+		    c1[2] = gamma * c1[2] + gamflip * c2[2];
+		    if (blend_alpha)
+			c1[3] += gamflip * c2[3];
+		}
+		else if (!dst->format->Amask)
+		{
+		    // nowhere to put the faded alpha, so fade to black
+		    c1[0] = gamma * c1[0];
+		    c1[1] = gamma * c1[1];
+		    c1[2] = gamma * c1[2];
+		}
+	    }
+	    write_span(dst, x, y, n, buf1);
 	}
-	*cpix1 = SDL_MapRGBA(fmt1,r1,g1,b1,a1);
     }
+}
 
-    SDL_UnlockSurface(tmpS);
 
-    if (S2 != NULL)
-	SDL_UnlockSurface(S2);
+/* Are a and b both 32 bit surfaces with the same layout? */
+static int same_format32(SDL_Surface* a, SDL_Surface* b)
+{
+    return a->format->BytesPerPixel == 4 && b->format->BytesPerPixel == 4
+	&& a->format->Rmask == b->format->Rmask
+	&& a->format->Gmask == b->format->Gmask
+	&& a->format->Bmask == b->format->Bmask
+	&& a->format->Amask == b->format->Amask;
+}
 
-    ret = SDL_DisplayFormatAlpha(tmpS);
-    SDL_FreeSurface(tmpS);
 
-    return ret;
+/* Multiply the colors of s by its alpha, so that T4K_BlitPremultiplied()
+   and the blit queue can composite it with one multiply per channel. */
+int T4K_PremultiplyAlpha(SDL_Surface* s)
+{
+    Uint8 buf[SPAN_CHUNK * 4];
+    Uint8* c;
+    int x, y, i, n;
+
+    if (!s || !s->format->Amask)
+    {
+	fprintf(stderr, "T4K_PremultiplyAlpha() - invalid arg or no alpha channel!\n");
+	return 0;
+    }
+    if (is_premultiplied(s))
+	return 1;
+    if (SDL_LockSurface(s) == -1)
+    {
+	fprintf(stderr, "T4K_PremultiplyAlpha() - SDL_LockSurface() failed: %s\n", SDL_GetError());
+	return 0;
+    }
+
+    for (y = 0; y < s->h; y++)
+    {
+	for (x = 0; x < s->w; x += n)
+	{
+	    n = (s->w - x < SPAN_CHUNK) ? s->w - x : SPAN_CHUNK;
+	    read_span(s, x, y, n, buf);
+	    for (i = 0, c = buf; i < n; i++, c += 4)
+	    {
+		c[0] = (c[0] * c[3] + 127) / 255;
+		c[1] = (c[1] * c[3] + 127) / 255;
+		c[2] = (c[2] * c[3] + 127) / 255;
+	    }
+	    write_span(s, x, y, n, buf);
+	}
+    }
+
+    SDL_UnlockSurface(s);
+    mark_premultiplied(s);
+    return 1;
+}
+
+
+int T4K_IsPremultiplied(SDL_Surface* s)
+{
+    return s && is_premultiplied(s);
+}
+
+
+static premulEntry** find_premultiplied(SDL_Surface* s)
+{
+    premulEntry** e = &premultiplied[((size_t)s >> 4) % PREMULTIPLIED_BUCKETS];
+
+    while (*e && (*e)->surf != s)
+	e = &(*e)->next;
+    return e;
+}
+
+static int is_premultiplied(SDL_Surface* s)
+{
+    return num_premultiplied && *find_premultiplied(s) != NULL;
+}
+
+/* Add s to the set of premultiplied surfaces. If we're out of memory */
+/* it is just drawn as a normal one, which looks a little dark.       */
+static void mark_premultiplied(SDL_Surface* s)
+{
+    premulEntry** e = find_premultiplied(s);
+
+    if (*e)
+	return;
+    *e = malloc(sizeof(premulEntry));
+    if (!*e)
+	return;
+    (*e)->surf = s;
+    (*e)->next = NULL;
+    s->refcount++;
+    num_premultiplied++;
+
+    if (num_premultiplied >= premultiplied_sweep_at)
+    {
+	sweep_premultiplied(0);
+	premultiplied_sweep_at = 2 * num_premultiplied + PREMULTIPLIED_BUCKETS;
+    }
+}
+
+/* Drop the surfaces only the set still holds, or all of them */
+static void sweep_premultiplied(int all)
+{
+    premulEntry** e;
+    premulEntry* dead;
+    int b;
+
+    for (b = 0; b < PREMULTIPLIED_BUCKETS && num_premultiplied; b++)
+    {
+	e = &premultiplied[b];
+	while (*e)
+	{
+	    if (all || (*e)->surf->refcount <= 1)
+	    {
+		dead = *e;
+		*e = dead->next;
+		SDL_FreeSurface(dead->surf);
+		free(dead);
+		num_premultiplied--;
+	    }
+	    else
+		e = &(*e)->next;
+	}
+    }
+}
+
+void free_premultiplied(void)
+{
+    sweep_premultiplied(1);
+    premultiplied_sweep_at = PREMULTIPLIED_BUCKETS;
+}
+
+
+/* Composite the (clipped) rect s of the premultiplied surface src */
+/* over dst at d: every channel becomes src + dst * (1 - src alpha) */
+static void blit_premultiplied(SDL_Surface* src, SDL_Rect* s, SDL_Surface* dst, SDL_Rect* d)
+{
+    Uint8 sbuf[SPAN_CHUNK * 4], dbuf[SPAN_CHUNK * 4];
+    Uint8 *cs, *cd;
+    int x, y, i, c, n, t;
+
+    /* (not SDL_LockSurface() on everything: the blit queue calls */
+    /* this from several threads at once for the same screen)     */
+    if (SDL_MUSTLOCK(src))
+	SDL_LockSurface(src);
+    if (SDL_MUSTLOCK(dst))
+	SDL_LockSurface(dst);
+
+    if (!reference_kernels
+	    && src->format->BytesPerPixel == 4 && dst->format->BytesPerPixel == 4
+	    && src->format->Rmask == dst->format->Rmask
+	    && src->format->Gmask == dst->format->Gmask
+	    && src->format->Bmask == dst->format->Bmask
+	    && (!dst->format->Amask || dst->format->Amask == src->format->Amask))
+    {
+	over32(src, s, dst, d);
+    }
+    else
+    {
+	// The generic way, a span at a time:
+	for (y = 0; y < s->h; y++)
+	{
+	    for (x = 0; x < s->w; x += n)
+	    {
+		n = (s->w - x < SPAN_CHUNK) ? s->w - x : SPAN_CHUNK;
+		read_span(src, s->x + x, s->y + y, n, sbuf);
+		read_span(dst, d->x + x, d->y + y, n, dbuf);
+		for (i = 0, cs = sbuf, cd = dbuf; i < n; i++, cs += 4, cd += 4)
+		{
+		    for (c = 0; c < 4; c++)
+		    {
+			t = cs[c] + (cd[c] * (255 - cs[3]) + 127) / 255;
+			cd[c] = (t > 255) ? 255 : t;
+		    }
+		}
+		write_span(dst, d->x + x, d->y + y, n, dbuf);
+	    }
+	}
+    }
+
+    if (SDL_MUSTLOCK(dst))
+	SDL_UnlockSurface(dst);
+    if (SDL_MUSTLOCK(src))
+	SDL_UnlockSurface(src);
+}
+
+
+/* Like SDL_BlitSurface(), but for surfaces from T4K_PremultiplyAlpha() */
+int T4K_BlitPremultiplied(SDL_Surface* src, SDL_Rect* srcrect, SDL_Surface* dst, SDL_Rect* dstrect)
+{
+    SDL_Rect s, d;
+
+    if (!src || !dst || !src->format->Amask)
+    {
+	fprintf(stderr, "T4K_BlitPremultiplied() - invalid arg!\n");
+	return 0;
+    }
+
+    if (srcrect)
+	s = *srcrect;
+    else
+    {
+	s.x = s.y = 0;
+	s.w = src->w;
+	s.h = src->h;
+    }
+    d.x = dstrect ? dstrect->x : 0;
+    d.y = dstrect ? dstrect->y : 0;
+
+    if (clip_blit(src, &s, dst, &d))
+	blit_premultiplied(src, &s, dst, &d);
+    else
+	d.w = d.h = 0;
+
+    /* (as SDL does, tell the caller what was actually drawn) */
+    if (dstrect)
+	*dstrect = d;
+    return 1;
 }
 
 
@@ -480,40 +1002,95 @@ void T4K_SetRect(SDL_Rect* rect, const float* pos)
     rect->h = pos[3] * screen->h;
 }
 
-/* Darkens the screen by a factor of 2^bits */
-void T4K_DarkenScreen(Uint8 bits)
+static int clip_to_screen(SDL_Rect* r);
+
+/* Darkens the rect r (already clipped to the screen) by 2^bits */
+static void darken_rect(SDL_Rect* r, int bits)
 {
-#if PIXEL_BITS == 32
-    Uint32* p;
-#elif PIXEL_BITS == 16
-    Uint16* p;
-#else
-    Uint16* p;
-    return;
-#endif
     Uint32 rm = screen->format->Rmask;
     Uint32 gm = screen->format->Gmask;
     Uint32 bm = screen->format->Bmask;
-
-
+    Uint32* q;
+    Uint16* p;
     int x, y;
 
-    /* (realistically, 1 and 2 are the only useful values) */
-    if (bits > 8)
-	return;
-
-    p = screen->pixels;
-
-    for (y = 0; y < screen->h; y++)
+    switch (screen->format->BytesPerPixel)
     {
-	for (x = 0; x < screen->w; x++)
-	{
-	    *p = (((*p&rm)>>bits)&rm)
-		| (((*p&gm)>>bits)&gm)
-		| (((*p&bm)>>bits)&bm);
-	    p++;
-	}
+	case 4:
+	    if (!reference_kernels)
+	    {
+		darken32(screen, r, bits);
+		break;
+	    }
+	    for (y = r->y; y < r->y + r->h; y++)
+	    {
+		q = (Uint32*)((Uint8*)screen->pixels + y * screen->pitch) + r->x;
+		for (x = 0; x < r->w; x++, q++)
+		{
+		    *q = (((*q&rm)>>bits)&rm)
+			| (((*q&gm)>>bits)&gm)
+			| (((*q&bm)>>bits)&bm);
+		}
+	    }
+	    break;
+
+	case 2:
+	    for (y = r->y; y < r->y + r->h; y++)
+	    {
+		p = (Uint16*)((Uint8*)screen->pixels + y * screen->pitch) + r->x;
+		for (x = 0; x < r->w; x++, p++)
+		{
+		    *p = (((*p&rm)>>bits)&rm)
+			| (((*p&gm)>>bits)&gm)
+			| (((*p&bm)>>bits)&bm);
+		}
+	    }
+	    break;
+
+	default:
+	    /* (paletted or 24 bit - not worth it) */
+	    break;
+    }
+}
+
+/* Darkens the screen by a factor of 2^bits */
+void T4K_DarkenScreen(Uint8 bits)
+{
+    SDL_Rect r;
+
+    /* (realistically, 1 and 2 are the only useful values) */
+    if (bits > 8)
+	return;
+
+    r.x = r.y = 0;
+    r.w = screen->w;
+    r.h = screen->h;
+
+    SDL_LockSurface(screen);
+    darken_rect(&r, bits);
+    SDL_UnlockSurface(screen);
+}
+
+/* Darkens just the given rects of the screen, and queues them to be */
+/* updated by the next T4K_UpdateScreen()                           */
+void T4K_DarkenRects(SDL_Rect* rects, int n, Uint8 bits)
+{
+    SDL_Rect r;
+    int i;
+
+    if (bits > 8 || !rects)
+	return;
+
+    SDL_LockSurface(screen);
+    for (i = 0; i < n; i++)
+    {
+	r = rects[i];
+	if (!clip_to_screen(&r))
+	    continue;
+	darken_rect(&r, bits);
+	T4K_AddRect(&r, &r);
     }
+    SDL_UnlockSurface(screen);
 }
 
 /* change window size (works only in windowed mode) */
@@ -614,6 +1191,11 @@ SDL_EventType T4K_WaitForEvent(SDL_EventMask events)
 	}
     }
 }
+
+/* T4K_zoom() only splits surfaces at least this big between threads: */
+#define SCALE_THREAD_AREA (256 * 256)
+static int scale_threads = 1;
+
 /* Swiped shamelessly from TuxPaint
    Based on code from: http://www.codeproject.com/cs/media/imageprocessing4.asp
    copyright 2002 Christian Graus */
@@ -622,24 +1204,20 @@ SDL_Surface* T4K_zoom(SDL_Surface* src, int new_w, int new_h)
 {
     SDL_Surface* s;
 
-    /* These function pointers will point to the appropriate */
-    /* putpixel() and getpixel() variants to be used in the  */
-    /* current colorspace:                                   */
-    void (*putpixel) (SDL_Surface*, int, int, Uint32);
-    Uint32(*getpixel) (SDL_Surface*, int, int);
-
     float xscale, yscale;
-    int x, y;
+    int x, y, i;
     int floor_x, ceil_x,
 	floor_y, ceil_y;
     float fraction_x, fraction_y,
 	  one_minus_x, one_minus_y;
     float n1, n2;
-    Uint8 r1, g1, b1, a1;
-    Uint8 r2, g2, b2, a2;
-    Uint8 r3, g3, b3, a3;
-    Uint8 r4, g4, b4, a4;
-    Uint8 r, g, b, a;
+
+    /* The generic code works a row at a time on R, G, B, A bytes:   */
+    /* row0 and row1 hold the two source rows (row0_y and row1_y) an */
+    /* output row is made from, and out the output row.              */
+    Uint8 *rows, *row0, *row1, *out, *tmp;
+    int row0_y = -1, row1_y = -1;
+    Uint8 *p1, *p2, *p3, *p4;
 
     DEBUGMSG(debug_sdl, "Entering T4K_zoom():\n");
 
@@ -667,20 +1245,73 @@ SDL_Surface* T4K_zoom(SDL_Surface* src, int new_w, int new_h)
     DEBUGMSG(debug_sdl, "T4K_zoom(): new surface %dx%d, %d bytes per pixel\n",
 	    s->w, s->h, s->format->BytesPerPixel);
 
-    /* Now assign function pointers to correct functions based */
-    /* on data format of original and zoomed surfaces:         */
-    getpixel = getpixels[src->format->BytesPerPixel];
-    putpixel = putpixels[s->format->BytesPerPixel];
-
     SDL_LockSurface(src);
     SDL_LockSurface(s);
 
+    /* 32 bit surfaces (i.e. nearly all of them) have a much faster path: */
+    if (s->format->BytesPerPixel == 4 && !reference_kernels
+	    && zoom32(src, s, (new_w * new_h >= SCALE_THREAD_AREA) ? scale_threads : 1))
+    {
+	SDL_UnlockSurface(s);
+	SDL_UnlockSurface(src);
+	/* (bilinear filtering works the same on premultiplied colors) */
+	if (is_premultiplied(src))
+	    mark_premultiplied(s);
+	DEBUGMSG(debug_sdl, "Leaving T4K_zoom():\n");
+	return s;
+    }
+
+    rows = malloc((src->w * 2 + new_w) * 4);
+    if (rows == NULL)
+    {
+	fprintf(stderr, "T4K_zoom() - out of memory\n");
+	SDL_UnlockSurface(s);
+	SDL_UnlockSurface(src);
+	SDL_FreeSurface(s);
+	return NULL;
+    }
+    row0 = rows;
+    row1 = row0 + src->w * 4;
+    out = row1 + src->w * 4;
+
     xscale = (float) src->w / (float) new_w;
     yscale = (float) src->h / (float) new_h;
 
-    for (x = 0; x < new_w; x++)
+    for (y = 0; y < new_h; y++)
     {
-	for (y = 0; y < new_h; y++)
+	/* figure out which original rows to use: */
+	floor_y = floor((float) y * yscale);
+	ceil_y = floor_y + 1;
+	if (ceil_y >= src->h)
+	    ceil_y = floor_y;
+
+	fraction_y = y * yscale - floor_y;
+	one_minus_y = 1.0 - fraction_y;
+
+	if (floor_y > src->h - 1)
+	    floor_y = ceil_y = src->h - 1;
+
+	/* and fetch them, unless we have them from the last row: */
+	if (floor_y == row1_y && floor_y != row0_y)
+	{
+	    tmp = row0;
+	    row0 = row1;
+	    row1 = tmp;
+	    row1_y = row0_y;
+	    row0_y = floor_y;
+	}
+	if (row0_y != floor_y)
+	{
+	    read_span(src, 0, floor_y, src->w, row0);
+	    row0_y = floor_y;
+	}
+	if (row1_y != ceil_y)
+	{
+	    read_span(src, 0, ceil_y, src->w, row1);
+	    row1_y = ceil_y;
+	}
+
+	for (x = 0; x < new_w; x++)
 	{
 	    /* Here we calculate the new RGBA values for each pixel */
 	    /* using a "weighted average" of the four pixels in the */
@@ -692,95 +1323,197 @@ SDL_Surface* T4K_zoom(SDL_Surface* src, int new_w, int new_h)
 	    if (ceil_x >= src->w)
 		ceil_x = floor_x;
 
-	    floor_y = floor((float) y * yscale);
-	    ceil_y = floor_y + 1;
-	    if (ceil_y >= src->h)
-		ceil_y = floor_y;
-
 	    fraction_x = x * xscale - floor_x;
-	    fraction_y = y * yscale - floor_y;
-
 	    one_minus_x = 1.0 - fraction_x;
-	    one_minus_y = 1.0 - fraction_y;
-
-	    /* Grab their values:  */
-	    SDL_GetRGBA(getpixel(src, floor_x, floor_y), src->format,
-		    &r1, &g1, &b1, &a1);
-	    SDL_GetRGBA(getpixel(src, ceil_x,  floor_y), src->format,
-		    &r2, &g2, &b2, &a2);
-	    SDL_GetRGBA(getpixel(src, floor_x, ceil_y),  src->format,
-		    &r3, &g3, &b3, &a3);
-	    SDL_GetRGBA(getpixel(src, ceil_x,  ceil_y),  src->format,
-		    &r4, &g4, &b4, &a4);
-
-	    /* Create the weighted averages: */
-	    n1 = (one_minus_x * r1 + fraction_x * r2);
-	    n2 = (one_minus_x * r3 + fraction_x * r4);
-	    r = (one_minus_y * n1 + fraction_y * n2);
-
-	    n1 = (one_minus_x * g1 + fraction_x * g2);
-	    n2 = (one_minus_x * g3 + fraction_x * g4);
-	    g = (one_minus_y * n1 + fraction_y * n2);
-
-	    n1 = (one_minus_x * b1 + fraction_x * b2);
-	    n2 = (one_minus_x * b3 + fraction_x * b4);
-	    b = (one_minus_y * n1 + fraction_y * n2);
-
-	    n1 = (one_minus_x * a1 + fraction_x * a2);
-	    n2 = (one_minus_x * a3 + fraction_x * a4);
-	    a = (one_minus_y * n1 + fraction_y * n2);
-
-	    /* and put them into our new surface: */
-	    putpixel(s, x, y, SDL_MapRGBA(s->format, r, g, b, a));
 
+	    if (floor_x > src->w - 1)
+		floor_x = ceil_x = src->w - 1;
+
+	    p1 = row0 + floor_x * 4;
+	    p2 = row0 + ceil_x * 4;
+	    p3 = row1 + floor_x * 4;
+	    p4 = row1 + ceil_x * 4;
+
+	    /* Create the weighted averages of R, G, B and A: */
+	    for (i = 0; i < 4; i++)
+	    {
+		n1 = (one_minus_x * p1[i] + fraction_x * p2[i]);
+		n2 = (one_minus_x * p3[i] + fraction_x * p4[i]);
+		out[x * 4 + i] = (one_minus_y * n1 + fraction_y * n2);
+	    }
 	}
+
+	/* and put them into our new surface: */
+	write_span(s, 0, y, new_w, out);
     }
 
+    free(rows);
     SDL_UnlockSurface(s);
     SDL_UnlockSurface(src);
+    if (is_premultiplied(src))
+	mark_premultiplied(s);
 
     DEBUGMSG(debug_sdl, "Leaving T4K_zoom():\n");
 
     return s;
 }
 
+
+/* T4K_zoomEx() : like T4K_zoom(), but with a choice of filter. Only */
+/* T4K_ZOOM_AREA on a 32 bit surface that is getting smaller in at  */
+/* least one direction is any different.                            */
+SDL_Surface* T4K_zoomEx(SDL_Surface* src, int new_w, int new_h, int mode)
+{
+    SDL_Surface* s;
+    int ok;
+
+    if (mode != T4K_ZOOM_AREA
+	    || src->format->BytesPerPixel != 4
+	    || (new_w >= src->w && new_h >= src->h))
+	return T4K_zoom(src, new_w, new_h);
+
+    DEBUGMSG(debug_sdl, "T4K_zoomEx(): area-averaging %dx%d to %dx%d\n",
+	    src->w, src->h, new_w, new_h);
+
+    s = SDL_CreateRGBSurface(src->flags,
+	    new_w, new_h, src->format->BitsPerPixel,
+	    src->format->Rmask,
+	    src->format->Gmask,
+	    src->format->Bmask,
+	    src->format->Amask);
+
+    if (s == NULL)
+    {
+	fprintf(stderr, "\nError: Can't build zoom surface\n"
+		"The Simple DirectMedia Layer error that occurred was:\n"
+		"%s\n\n", SDL_GetError());
+	return NULL;
+    }
+
+    SDL_LockSurface(src);
+    SDL_LockSurface(s);
+    ok = zoom_area32(src, s, (new_w * new_h >= SCALE_THREAD_AREA) ? scale_threads : 1,
+	    is_premultiplied(src));
+    SDL_UnlockSurface(s);
+    SDL_UnlockSurface(src);
+
+    /* out of memory - the plain version needs less */
+    if (!ok)
+    {
+	SDL_FreeSurface(s);
+	return T4K_zoom(src, new_w, new_h);
+    }
+    if (is_premultiplied(src))
+	mark_premultiplied(s);
+    return s;
+}
+
+
+void T4K_SetScaleThreads(int n)
+{
+    if (n < 0)
+	n = pool_cpu_count();
+    if (n > 1)
+	n = pool_reserve(n);
+    if (n < 1)
+	n = 1;
+    scale_threads = n;
+    DEBUGMSG(debug_sdl, "T4K_SetScaleThreads(): scaling with %d threads\n", scale_threads);
+}
+
+
 /*************************************************/
 /* TransWipe: Performs various wipes to new bkgs */
 /*************************************************/
+/*
+ * A wipe uncovers the new background a strip at a time, working
+ * out from the middle of each segment. How far it has got is worked
+ * out from the time since it started, so it takes as long as asked
+ * however slow the machine, and each step only blits (and queues
+ * for update) the strips uncovered since the last one.
+ *
+ * The other styles work the same way: a crossfade only redraws rows
+ * that differ between the two images, and only when the fade level
+ * has moved on; a dissolve uncovers the pixels of the next few
+ * places in a 16x16 ordered dither pattern, all over the screen.
+ */
+
+/* T4K_TransWipe() duration is in frames of about this long: */
+#define WIPE_FRAME_MS 20
+
+static struct {
+    SDL_Surface* bkg;   // NULL if no wipe is running
+    WipeStyle type;
+    int segments;
+    Uint32 start;
+    Uint32 duration;    // in ms
+    int done_x, done_y; // how far out each segment is uncovered
+    int level;          // fade level or dissolve places done, 0 - 256
+    SDL_Surface* old;   // crossfade: copy of the screen when we started
+    Uint8* rows;        // crossfade: nonzero for rows that differ
+} wipe;
+
+#define DISSOLVE_SIZE 16
+static Uint8 dissolve_order[DISSOLVE_SIZE * DISSOLVE_SIZE];
+
+static void wipe_strips(int along_x, int from, int to);
+static int crossfade_start(void);
+static void crossfade_step(int level);
+static void dissolve_step(int level);
+static void slide_step(int along_x, int pos);
+
+
 /*
  * Given a wipe request type, and any variables
  * that wipe requires, will perform a wipe from
  * the current screen image to a new one.
- * NOTE duration should be given in tenths-of-seconds
- * NOTE this transition is uninterruptible!
+ * NOTE duration is in frames of about WIPE_FRAME_MS
+ * NOTE this transition is uninterruptible! Use
+ * T4K_TransWipeStart() and friends from a game loop
+ * to keep it running meanwhile.
  */
 int T4K_TransWipe(const SDL_Surface* newbkg, WipeStyle type, int segments, int duration)
 {
-    int i, j, x1, x2, y1, y2;
-    int step1, step2, step3, step4;
-    //int frame;
-    SDL_Rect src;
-    SDL_Rect dst;
+    int frame = 0;
 
-    T4K_ResetBlitQueue();
+    if (duration < 1)
+	duration = 1;
+    if (!T4K_TransWipeStart(newbkg, type, segments, duration * WIPE_FRAME_MS))
+	return 0;
+
+    while (T4K_TransWipeStep())
+    {
+	T4K_UpdateScreen(&frame);
+	SDL_Delay(10);
+    }
+    T4K_UpdateScreen(&frame);
+    return 1;
+}
 
+
+int T4K_TransWipeStart(const SDL_Surface* newbkg, WipeStyle type, int segments, int duration)
+{
     /* Input validation: ----------------------- */
     if (!newbkg)
     {
-	fprintf(stderr, "T4K_TransWipe() - 'newbkg' arg invalid!\n");
+	fprintf(stderr, "T4K_TransWipeStart() - 'newbkg' arg invalid!\n");
 	return 0;
     }
 
     /* FIXME should support scaling here - DSB */
     if(newbkg->w != screen->w || newbkg->h != screen->h)
     {
-	fprintf(stderr, "T4K_TransWipe() - wrong size newbkg* arg");
+	fprintf(stderr, "T4K_TransWipeStart() - wrong size newbkg* arg\n");
 	return 0;
     }
 
-    /* segments is num of divisions */
-    /* duration is how many frames animation should take */
+    /* a wipe already running just ends where it is: */
+    if (wipe.bkg)
+	T4K_TransWipeFinish();
+
+    T4K_ResetBlitQueue();
 
+    /* segments is num of divisions */
     if(segments < 1)
 	segments = 1;
     if(duration < 1)
@@ -790,379 +1523,1569 @@ int T4K_TransWipe(const SDL_Surface* newbkg, WipeStyle type, int segments, int d
     while(type == RANDOM_WIPE)
 	type = rand() % NUM_WIPES;
 
+    /* our crossfade only blends 32 bit pixels: */
+    if (type == WIPE_CROSSFADE && screen->format->BitsPerPixel != 32)
+	type = WIPE_DISSOLVE;
+
+    DEBUGVARX(debug_sdl, type);
+
+    /* hold on to it until the wipe is over. Styles that mix pixels */
+    /* themselves need it in the same format as the screen:         */
+    wipe.bkg = (SDL_Surface*)newbkg;
+    wipe.bkg->refcount++;
+    if ((type == WIPE_CROSSFADE || type == WIPE_DISSOLVE)
+	    && (newbkg->format->BitsPerPixel != screen->format->BitsPerPixel
+		|| newbkg->format->Rmask != screen->format->Rmask
+		|| newbkg->format->Gmask != screen->format->Gmask
+		|| newbkg->format->Bmask != screen->format->Bmask))
+    {
+	SDL_FreeSurface(wipe.bkg);
+	wipe.bkg = SDL_ConvertSurface((SDL_Surface*)newbkg, screen->format, SDL_SWSURFACE);
+	if (!wipe.bkg)
+	{
+	    fprintf(stderr, "T4K_TransWipeStart() - SDL_ConvertSurface() failed: %s\n",
+		    SDL_GetError());
+	    return 0;
+	}
+    }
+
+    wipe.type = type;
+    wipe.segments = segments;
+    wipe.start = SDL_GetTicks();
+    wipe.duration = duration;
+    wipe.done_x = wipe.done_y = 0;
+    wipe.level = 0;
+    wipe.old = NULL;
+    wipe.rows = NULL;
+
+    /* without a copy of the old screen, just cut to the new one: */
+    if (type == WIPE_CROSSFADE && !crossfade_start())
+	wipe.duration = 0;
+
+    return 1;
+}
+
+
+int T4K_TransWipeStep(void)
+{
+    Uint32 elapsed;
+    int seg_w, seg_h, x, y, level;
+
+    if (!wipe.bkg)
+	return 0;
+
+    elapsed = SDL_GetTicks() - wipe.start;
+    if (elapsed >= wipe.duration)
+    {
+	T4K_TransWipeFinish();
+	return 0;
+    }
+
+    /* distance out from the middle of a segment we should be at now: */
+    seg_w = (screen->w + wipe.segments - 1) / wipe.segments;
+    seg_h = (screen->h + wipe.segments - 1) / wipe.segments;
+    x = ((seg_w + 1) / 2) * elapsed / wipe.duration;
+    y = ((seg_h + 1) / 2) * elapsed / wipe.duration;
+    level = 256 * elapsed / wipe.duration;
+
+    switch(wipe.type)
+    {
+	case WIPE_BLINDS_VERT:
+	    wipe_strips(1, wipe.done_x, x);
+	    wipe.done_x = x;
+	    break;
+
+	case WIPE_BLINDS_HORIZ:
+	    wipe_strips(0, wipe.done_y, y);
+	    wipe.done_y = y;
+	    break;
+
+	case WIPE_BLINDS_BOX:
+	    wipe_strips(1, wipe.done_x, x);
+	    wipe_strips(0, wipe.done_y, y);
+	    wipe.done_x = x;
+	    wipe.done_y = y;
+	    break;
+
+	case WIPE_CROSSFADE:
+	    crossfade_step(level);
+	    wipe.level = level;
+	    break;
+
+	case WIPE_DISSOLVE:
+	    dissolve_step(level);
+	    wipe.level = level;
+	    break;
+
+	case WIPE_SLIDE_LEFT:
+	    slide_step(1, screen->w * elapsed / wipe.duration);
+	    break;
+
+	case WIPE_SLIDE_UP:
+	    slide_step(0, screen->h * elapsed / wipe.duration);
+	    break;
+
+	default:
+	    break;
+    }
+
+    return 1;
+}
+
+
+void T4K_TransWipeFinish(void)
+{
+    SDL_Rect r;
+
+    if (!wipe.bkg)
+	return;
+
+    r.x = 0;
+    r.y = 0;
+    r.w = screen->w;
+    r.h = screen->h;
+    SDL_BlitSurface(wipe.bkg, NULL, screen, &r);
+    T4K_AddRect(&r, &r);
+
+    SDL_FreeSurface(wipe.bkg);
+    wipe.bkg = NULL;
+    if (wipe.old)
+	SDL_FreeSurface(wipe.old);
+    wipe.old = NULL;
+    free(wipe.rows);
+    wipe.rows = NULL;
+}
+
+
+/* Uncover the strips from 'from' to 'to' pixels out from the middle  */
+/* of each segment, on both sides: columns across the screen if       */
+/* along_x, otherwise rows down it. Segments are cut where the screen */
+/* ends, and each strip stays inside its own segment.                 */
+static void wipe_strips(int along_x, int from, int to)
+{
+    SDL_Rect r;
+    int size = along_x ? screen->w : screen->h;
+    int seg = (size + wipe.segments - 1) / wipe.segments;
+    int j, start, end, mid, a, b;
+
+    if (to <= from)
+	return;
+
+    for (j = 0; j < wipe.segments; j++)
+    {
+	start = j * seg;
+	end = start + seg;
+	if (end > size)
+	    end = size;
+	if (start >= end)
+	    break;
+	mid = (start + end) / 2;
+
+	/* left (or top) of the middle, then right (or bottom): */
+	a = mid - to;
+	if (a < start)
+	    a = start;
+	b = mid - from;
+	if (a < b)
+	{
+	    r.x = along_x ? a : 0;
+	    r.y = along_x ? 0 : a;
+	    r.w = along_x ? b - a : screen->w;
+	    r.h = along_x ? screen->h : b - a;
+	    SDL_BlitSurface(wipe.bkg, &r, screen, &r);
+	    T4K_AddRect(&r, &r);
+	}
+
+	a = mid + from;
+	b = mid + to;
+	if (b > end)
+	    b = end;
+	if (a < b)
+	{
+	    r.x = along_x ? a : 0;
+	    r.y = along_x ? 0 : a;
+	    r.w = along_x ? b - a : screen->w;
+	    r.h = along_x ? screen->h : b - a;
+	    SDL_BlitSurface(wipe.bkg, &r, screen, &r);
+	    T4K_AddRect(&r, &r);
+	}
+    }
+}
+
+
+/* Keep a copy of the screen to fade from, and note which rows the */
+/* new image actually changes, so the rest are never redrawn.      */
+static int crossfade_start(void)
+{
+    int y, n = 0;
+
+    wipe.old = SDL_ConvertSurface(screen, screen->format, SDL_SWSURFACE);
+    wipe.rows = malloc(screen->h);
+    if (!wipe.old || !wipe.rows)
+    {
+	fprintf(stderr, "T4K_TransWipeStart() - out of memory for crossfade\n");
+	return 0;
+    }
+
+    SDL_LockSurface(wipe.old);
+    SDL_LockSurface(wipe.bkg);
+    for (y = 0; y < screen->h; y++)
+    {
+	wipe.rows[y] = memcmp((Uint8*)wipe.old->pixels + y * wipe.old->pitch,
+		(Uint8*)wipe.bkg->pixels + y * wipe.bkg->pitch, screen->w * 4) != 0;
+	n += wipe.rows[y];
+    }
+    SDL_UnlockSurface(wipe.bkg);
+    SDL_UnlockSurface(wipe.old);
+
+    DEBUGMSG(debug_sdl, "crossfade_start(): %d of %d rows change\n", n, screen->h);
+    return 1;
+}
+
+
+/* Blend each run of changing rows at the new level, if it is new */
+static void crossfade_step(int level)
+{
+    SDL_Rect r;
+    int y;
+
+    if (level == wipe.level)
+	return;
+
+    r.x = 0;
+    r.w = screen->w;
+    for (y = 0; y < screen->h; y++)
+    {
+	if (!wipe.rows[y])
+	    continue;
+	r.y = y;
+	while (y < screen->h && wipe.rows[y])
+	    y++;
+	r.h = y - r.y;
+	T4K_BlendInto(screen, wipe.bkg, wipe.old, level / 256.0, &r);
+	T4K_AddRect(&r, &r);
+    }
+}
+
+
+/* Uncover the pixels at dither places wipe.level to level - 1 in */
+/* every DISSOLVE_SIZE square of the screen.                       */
+static void dissolve_step(int level)
+{
+    SDL_Rect r;
+    Uint8 *s, *d;
+    int bpp = screen->format->BytesPerPixel;
+    int i, x, y;
+
+    if (level <= wipe.level)
+	return;
+
+    /* dissolve_order[n] is the place (y * 16 + x) that is uncovered */
+    /* n-th: the inverse of a 16x16 Bayer matrix, built bit by bit.   */
+    if (dissolve_order[1] == 0)
+    {
+	for (y = 0; y < DISSOLVE_SIZE; y++)
+	{
+	    for (x = 0; x < DISSOLVE_SIZE; x++)
+	    {
+		int b, rank = 0, xy = x ^ y;
+		for (b = 0; b < 4; b++)
+		    rank |= (((xy >> b) & 1) << (7 - 2 * b)) | (((y >> b) & 1) << (6 - 2 * b));
+		dissolve_order[rank] = y * DISSOLVE_SIZE + x;
+	    }
+	}
+    }
+
+    if (SDL_LockSurface(screen) == -1)
+	return;
+    SDL_LockSurface(wipe.bkg);
+
+    for (i = wipe.level; i < level; i++)
+    {
+	for (y = dissolve_order[i] / DISSOLVE_SIZE; y < screen->h; y += DISSOLVE_SIZE)
+	{
+	    s = (Uint8*)wipe.bkg->pixels + y * wipe.bkg->pitch;
+	    d = (Uint8*)screen->pixels + y * screen->pitch;
+	    for (x = dissolve_order[i] % DISSOLVE_SIZE; x < screen->w; x += DISSOLVE_SIZE)
+		memcpy(d + x * bpp, s + x * bpp, bpp);
+	}
+    }
+
+    SDL_UnlockSurface(wipe.bkg);
+    SDL_UnlockSurface(screen);
+
+    r.x = 0;
+    r.y = 0;
+    r.w = screen->w;
+    r.h = screen->h;
+    T4K_AddRect(&r, &r);
+}
+
+
+/* The new image slides in over the old one from the right (or the */
+/* bottom), pos pixels of it showing so far.                       */
+static void slide_step(int along_x, int pos)
+{
+    SDL_Rect src, dst;
+
+    if (pos <= (along_x ? wipe.done_x : wipe.done_y))
+	return;
+    if (along_x)
+	wipe.done_x = pos;
+    else
+	wipe.done_y = pos;
+
+    src.x = 0;
+    src.y = 0;
+    src.w = along_x ? pos : screen->w;
+    src.h = along_x ? screen->h : pos;
+    dst.x = along_x ? screen->w - pos : 0;
+    dst.y = along_x ? 0 : screen->h - pos;
+    SDL_BlitSurface(wipe.bkg, &src, screen, &dst);
+    dst.w = src.w;
+    dst.h = src.h;
+    T4K_AddRect(&dst, &dst);
+}
+
+
+
+
+
+
+/************************************************************************/
+/*                                                                      */
+/*        Begin blit queue support                                      */
+/*                                                                      */
+/* This code (modified from Sam Lantinga's "Alien" example program)     */
+/* implements a blit queue to perform screen updates in a more          */
+/* optimized fashion.                                                   */
+/************************************************************************/
+
+//With fullscreen, we need more updates - 180 wasn't enough
+//The queues grow beyond this as needed, so this is just a starting point
+#define INITIAL_UPDATES 512
+
+/* --- Data Structure for Dirty Blitting --- */
+/* Each layer has its own queue, stored as a structure of arrays carved */
+/* out of a single block of memory (the "arena"), so the erase and draw */
+/* passes stream through contiguous memory. The arena is reset (not     */
+/* freed) by T4K_UpdateScreen() and only grows when a frame queues more */
+/* blits than ever before, so steady-state queuing does no allocation.  */
+/* On a retained layer the first 'kept' entries are draws carried over  */
+/* from earlier frames; anything after them was queued this frame.      */
+struct blit_queue {
+    SDL_Surface** src;
+    SDL_Rect* srcrect;
+    SDL_Rect* dstrect;
+    Uint8* type;
+    int num;    // tracks how many blits to be done
+    int cap;    // how many blits fit in the arena
+    int kept;   // draws retained from earlier frames
+    int retained;
+    void* arena;
+};
+
+static struct blit_queue layers[T4K_NUM_LAYERS];
+
+/* Every rect touched this frame, in drawing order. Used both to find */
+/* the parts of retained layers that need redrawing and as the list  */
+/* of rects to push to the display.                                  */
+static SDL_Rect* frame_rects = NULL;
+static int num_frame_rects = 0;
+static int cap_frame_rects = 0;
+
+/* The part of the damage a retained layer has to redraw, cut into  */
+/* disjoint rects. Redrawing over overlapping damage rects would    */
+/* blend translucent retained draws into the same pixels repeatedly. */
+struct damage_piece {
+    SDL_Rect r;
+    int next;   // first disjoint rect r has not been checked against
+};
+static SDL_Rect* damage_rects = NULL;
+static int cap_damage_rects = 0;
+static struct damage_piece* damage_pieces = NULL;
+static int cap_damage_pieces = 0;
+
+static int queue_blit(int layer);
+static int add_frame_rect(SDL_Rect* r);
+static void redraw_retained(struct blit_queue* q, int n_damage);
+static int disjoint_damage(struct blit_queue* q, int n_damage);
+static int intersect_rects(SDL_Rect* a, SDL_Rect* b, SDL_Rect* out);
+
+/* --- Data Structures for Occlusion Culling --- */
+/* Erases and draws that a later opaque draw will completely cover are */
+/* flagged before the queues are run and then skipped. Retained draws  */
+/* keep their entry (and so stay retained) but lose the flag again.    */
+#define BLIT_CULLED 0x80
+#define CULL_STATS_FRAMES 300 // how often to print the hit rate
+struct occluder {
+    SDL_Rect r;  // screen-clipped destination rect
+    int layer;
+    int index;
+};
+static struct occluder* occluders = NULL;
+static int cap_occluders = 0;
+static long cull_checked = 0;
+static long cull_hits = 0;
+static int cull_frames = 0;
+
+static void cull_occluded(void);
+static int clip_to_screen(SDL_Rect* r);
+
+/* --- Data Structures for Threaded Compositing --- */
+/* The queues are first turned into a list of clipped blits, in the */
+/* order they have to be done. If there are enough pixels to make  */
+/* it worthwhile, the screen is then cut into horizontal bands and */
+/* the worker pool runs the whole list on each band in parallel.   */
+#define DEFAULT_THREAD_AREA (256 * 256)
+#define MIN_BAND_ROWS 16
+struct blit_op {
+    SDL_Surface* src;
+    SDL_Rect srcrect;
+    SDL_Rect dstrect;
+};
+static struct blit_op* blit_ops = NULL;
+static int num_blit_ops = 0;
+static int cap_blit_ops = 0;
+static long blit_ops_area = 0;
+static int blit_threads = 1;
+static long blit_thread_area = DEFAULT_THREAD_AREA;
+
+static void add_blit_op(SDL_Surface* src, SDL_Rect* srcrect, SDL_Rect* dstrect);
+static void run_blit_ops(void);
+static void blit_band(void* arg, int band, int nbands);
+static void blit_to_screen(SDL_Surface* src, SDL_Rect* s, SDL_Rect* d);
+
+/* --- Data Structures for Dirty Rect Coalescing --- */
+/* Before the display is updated, the queued rects are marked on a coarse */
+/* grid of UPDATE_TILE x UPDATE_TILE tiles and runs of dirty tiles are    */
+/* merged back into rects, so that overlapping erase and draw entries     */
+/* push each pixel to the display only once.                              */
+#define UPDATE_TILE 8
+static Uint8* dirty_tiles = NULL;     // one byte per tile, nonzero if dirty
+static SDL_Rect* merged_rects = NULL; // coalesced rects handed to SDL
+static int* open_rects = NULL;        // merged rects that end on the previous tile row
+static int* next_open_rects = NULL;   // merged rects that end on the current tile row
+static int tiles_w = 0;
+static int tiles_h = 0;
+
+/* If the coalesced area exceeds this fraction of the screen, we just */
+/* update the whole screen with a single rect:                        */
+static float full_update_fraction = 0.5;
+
+static long update_dirty_rects(SDL_Rect* rects, int n);
+static int alloc_dirty_tiles(void);
+static int grow_blit_queue(struct blit_queue* q, int cap);
+
+
+
+/***********************
+  T4K_InitBlitQueue()
+ ***********************/
+void T4K_InitBlitQueue(void)
+{
+    int i;
+
+    /* --- Make sure the arenas exist before the first frame --- */
+    for (i = 0; i < T4K_NUM_LAYERS; i++)
+    {
+	if (layers[i].cap < INITIAL_UPDATES && !grow_blit_queue(&layers[i], INITIAL_UPDATES))
+	    fprintf(stderr, "T4K_InitBlitQueue() - could not allocate blit queue!\n");
+	layers[i].num = layers[i].kept;
+    }
+}
+
+
+/* free the arenas and the rect coalescing buffers */
+void free_blit_queue(void)
+{
+    int i;
+
+    for (i = 0; i < T4K_NUM_LAYERS; i++)
+    {
+	free(layers[i].arena);
+	memset(&layers[i], 0, sizeof(struct blit_queue));
+    }
+
+    free(frame_rects);
+    frame_rects = NULL;
+    num_frame_rects = cap_frame_rects = 0;
+
+    free(damage_rects);
+    free(damage_pieces);
+    damage_rects = NULL;
+    damage_pieces = NULL;
+    cap_damage_rects = cap_damage_pieces = 0;
+
+    free(occluders);
+    occluders = NULL;
+    cap_occluders = 0;
+
+    free(blit_ops);
+    blit_ops = NULL;
+    num_blit_ops = cap_blit_ops = 0;
+
+    free(dirty_tiles);
+    free(merged_rects);
+    free(open_rects);
+    free(next_open_rects);
+    dirty_tiles = NULL;
+    merged_rects = NULL;
+    open_rects = NULL;
+    next_open_rects = NULL;
+    tiles_w = tiles_h = 0;
+}
+
+
+/* Move a queue into a new arena with room for cap blits.   */
+/* Returns 1 on success, 0 (leaving the queue alone) if the */
+/* allocation failed.                                       */
+static int grow_blit_queue(struct blit_queue* q, int cap)
+{
+    struct blit_queue n = *q;
+    Uint8* p;
+
+    /* pointers first, then rects, then bytes, to keep everything aligned: */
+    p = malloc(cap * (sizeof(SDL_Surface*) + 2 * sizeof(SDL_Rect) + sizeof(Uint8)));
+    if (!p)
+	return 0;
+
+    n.arena = p;
+    n.src = (SDL_Surface**)p;
+    p += cap * sizeof(SDL_Surface*);
+    n.srcrect = (SDL_Rect*)p;
+    p += cap * sizeof(SDL_Rect);
+    n.dstrect = (SDL_Rect*)p;
+    p += cap * sizeof(SDL_Rect);
+    n.type = p;
+    n.cap = cap;
+
+    if (q->num > 0)
+    {
+	memcpy(n.src, q->src, q->num * sizeof(SDL_Surface*));
+	memcpy(n.srcrect, q->srcrect, q->num * sizeof(SDL_Rect));
+	memcpy(n.dstrect, q->dstrect, q->num * sizeof(SDL_Rect));
+	memcpy(n.type, q->type, q->num * sizeof(Uint8));
+    }
+    free(q->arena);
+    *q = n;
+
+    DEBUGMSG(debug_sdl, "grow_blit_queue(): layer %d queue now holds %d entries\n",
+	    (int)(q - layers), cap);
+    return 1;
+}
+
+
+/* Reserve the next entry in a layer's queue, growing it if need be. */
+/* Returns the index of the entry, or -1 on a bad layer or if we ran */
+/* out of RAM.                                                       */
+static int queue_blit(int layer)
+{
+    struct blit_queue* q;
+
+    if (layer < 0 || layer >= T4K_NUM_LAYERS)
+    {
+	fprintf(stderr, "Warning - invalid layer %d, cannot add blit to queue\n", layer);
+	return -1;
+    }
+
+    q = &layers[layer];
+    if (q->num >= q->cap
+	    && !grow_blit_queue(q, q->cap ? q->cap * 2 : INITIAL_UPDATES))
+    {
+	fprintf(stderr, "Warning - could not grow blit queue, cannot add blit to queue\n");
+	return -1;
+    }
+    return q->num++;
+}
+
+
+/* Append a rect to this frame's list of touched rects. */
+static int add_frame_rect(SDL_Rect* r)
+{
+    SDL_Rect* p;
+    int cap;
+
+    if (num_frame_rects >= cap_frame_rects)
+    {
+	cap = cap_frame_rects ? cap_frame_rects * 2 : INITIAL_UPDATES;
+	p = realloc(frame_rects, cap * sizeof(SDL_Rect));
+	if (!p)
+	{
+	    fprintf(stderr, "Warning - could not grow update list, rect will not be updated\n");
+	    return 0;
+	}
+	frame_rects = p;
+	cap_frame_rects = cap;
+    }
+    frame_rects[num_frame_rects++] = *r;
+    return 1;
+}
+
+
+/**************************
+  ResetBlitQueue(): just set the number
+  of pending updates to zero
+ ***************************/
+void T4K_ResetBlitQueue(void)
+{
+    int i;
+
+    for (i = 0; i < T4K_NUM_LAYERS; i++)
+	layers[i].num = layers[i].kept;
+}
+
+
+/**************************
+  SetLayerRetained(): keep a layer's
+  draws from one frame to the next
+ ***************************/
+void T4K_SetLayerRetained(int layer, int retained)
+{
+    if (layer < 0 || layer >= T4K_NUM_LAYERS)
+    {
+	fprintf(stderr, "T4K_SetLayerRetained() - invalid layer %d\n", layer);
+	return;
+    }
+    layers[layer].retained = retained;
+    /* draws we were keeping get done once more, then flushed as usual: */
+    if (!retained)
+	layers[layer].kept = 0;
+}
+
+
+/**************************
+  ClearLayer(): drop everything
+  queued on a layer
+ ***************************/
+void T4K_ClearLayer(int layer)
+{
+    if (layer < 0 || layer >= T4K_NUM_LAYERS)
+    {
+	fprintf(stderr, "T4K_ClearLayer() - invalid layer %d\n", layer);
+	return;
+    }
+    layers[layer].num = layers[layer].kept = 0;
+}
+
+
+/******************************
+AddRect : Don't actually blit a surface,
+but add a rect to be updated next
+update
+ *******************************/
+int T4K_AddRect(SDL_Rect* src, SDL_Rect* dst)
+{
+    return T4K_AddRectOnLayer(src, dst, T4K_LAYER_SPRITES);
+}
+
+
+int T4K_AddRectOnLayer(SDL_Rect* src, SDL_Rect* dst, int layer)
+{
+
+    /*borrowed from SL's alien (and modified)*/
+    struct blit_queue* q;
+    int i;
+
+    if(!src)
+    {
+	fprintf(stderr, "T4K_AddRect() - invalid 'src' arg!\n");
+	return 0;
+    }
+
+    if(!dst)
+    {
+	fprintf(stderr, "T4K_AddRect() - invalid 'dst' arg!\n");
+	return 0;
+    }
+
+    i = queue_blit(layer);
+    if(i < 0)
+	return 0;
+    q = &layers[layer];
+
+    q->src[i] = NULL;
+    q->srcrect[i] = *src;
+    q->dstrect[i] = *dst;
+    q->type[i] = 'I';
+
+    return 1;
+}
+
+
+
+int T4K_DrawSprite(sprite* gfx, int x, int y)
+{
+    return T4K_DrawSpriteOnLayer(gfx, x, y, T4K_LAYER_SPRITES);
+}
+
+
+int T4K_DrawSpriteOnLayer(sprite* gfx, int x, int y, int layer)
+{
+    if (!gfx || !gfx->frame[gfx->cur])
+    {
+	fprintf(stderr, "T4K_DrawSprite() - 'gfx' arg invalid!\n");
+	return 0;
+    }
+    return T4K_DrawObjectOnLayer(gfx->frame[gfx->cur], x, y, layer);
+}
+
+
+
+/**********************
+DrawObject : Draw an object at the specified
+location. No respect to clipping!
+ *************************/
+int T4K_DrawObject(SDL_Surface* surf, int x, int y)
+{
+    return T4K_DrawObjectOnLayer(surf, x, y, T4K_LAYER_SPRITES);
+}
+
+
+int T4K_DrawObjectOnLayer(SDL_Surface* surf, int x, int y, int layer)
+{
+    struct blit_queue* q;
+    int i;
+
+    if (!surf)
+    {
+	fprintf(stderr, "T4K_DrawObject() - invalid 'surf' arg!\n");
+	return 0;
+    }
+
+    i = queue_blit(layer);
+    if(i < 0)
+	return 0;
+    q = &layers[layer];
+
+    q->src[i] = surf;
+    q->srcrect[i].x = 0;
+    q->srcrect[i].y = 0;
+    q->srcrect[i].w = surf->w;
+    q->srcrect[i].h = surf->h;
+    q->dstrect[i].x = x;
+    q->dstrect[i].y = y;
+    q->dstrect[i].w = surf->w;
+    q->dstrect[i].h = surf->h;
+    q->type[i] = 'D';
+
+    return 1;
+}
+
+
+
+/************************
+UpdateScreen : Update the screen and increment the frame num
+ ***************************/
+void T4K_UpdateScreen(int* frame)
+{
+    struct blit_queue* q;
+    int i, l, n;
+    long area;
+
+    /* -- the performance HUD queues itself when it changes -- */
+    perfhud_update();
+
+    /* -- let go of premultiplied surfaces the game is done with -- */
+    sweep_premultiplied(0);
+
+    num_frame_rects = 0;
+    num_blit_ops = 0;
+    blit_ops_area = 0;
+
+    /* -- skip work a later opaque draw would hide anyway -- */
+    cull_occluded();
+
+    /* -- First erase everything we need to, on every layer -- */
+    for (l = 0; l < T4K_NUM_LAYERS; l++)
+    {
+	q = &layers[l];
+	for (i = q->kept; i < q->num; i++)
+	{
+	    if (q->type[i] == 'E')
+	    {
+		//       DEBUGCODE(debug_sdl)
+		//       {
+		//         fprintf(stderr, "Erasing blits[%d]\n", i);
+		//         fprintf(stderr, "srcrect->x = %d\t srcrect->y = %d\t srcrect->w = %d\t srcrect->h = %d\n",
+		//               blits[i].srcrect->x, blits[i].srcrect->y, blits[i].srcrect->w, blits[i].srcrect->h);
+		//         fprintf(stderr, "dstrect->x = %d\t dstrect->y = %d\t dstrect->w = %d\t dstrect->h = %d\n",
+		//               blits[i].dstrect->x, blits[i].dstrect->y, blits[i].dstrect->w, blits[i].dstrect->h);
+		//       }
+
+		add_blit_op(q->src[i], &q->srcrect[i], &q->dstrect[i]);
+	    }
+	}
+    }
+
+    //  SNOW_erase();
+
+    /* -- then draw, bottom layer first -- */
+    for (l = 0; l < T4K_NUM_LAYERS; l++)
+    {
+	q = &layers[l];
+
+	/* retained draws only need redoing where lower layers touched them: */
+	n = num_frame_rects;
+	if (q->kept > 0 && n > 0)
+	    redraw_retained(q, n);
+
+	for (i = q->kept; i < q->num; i++)
+	{
+	    if (q->type[i] == 'D')
+	    {
+		//       DEBUGCODE(debug_sdl)
+		//       {
+		//         fprintf(stderr, "drawing blits[%d]\n", i);
+		//         fprintf(stderr, "srcrect->x = %d\t srcrect->y = %d\t srcrect->w = %d\t srcrect->h = %d\n",
+		//               blits[i].srcrect->x, blits[i].srcrect->y, blits[i].srcrect->w, blits[i].srcrect->h);
+		//         fprintf(stderr, "dstrect->x = %d\t dstrect->y = %d\t dstrect->w = %d\t dstrect->h = %d\n",
+		//               blits[i].dstrect->x, blits[i].dstrect->y, blits[i].dstrect->w, blits[i].dstrect->h);
+		//       }
+
+		add_blit_op(q->src[i], &q->srcrect[i], &q->dstrect[i]);
+	    }
+	    else if (q->type[i] == 'I')
+		add_frame_rect(&q->dstrect[i]);
+	}
+    }
+
+    run_blit_ops();
 
-    T4K_ResetBlitQueue();
-    //frame = 0;
+    //  SNOW_draw();
 
-    DEBUGVARX(debug_sdl, type);
+    /* -- update the screen only where we need to! -- */
+    //  if (SNOW_on)
+    //    SDL_UpdateRects(screen, SNOW_add( (SDL_Rect*)&dstupdate, numupdates ), SNOW_rects);
+    //  else
+    area = update_dirty_rects(frame_rects, num_frame_rects);
+    framestats_add_frame(num_blit_ops, blit_ops_area, area);
 
-    switch(type)
+    /* -- flush the queues, keeping the draws on retained layers -- */
+    for (l = 0; l < T4K_NUM_LAYERS; l++)
     {
-	case WIPE_BLINDS_VERT:
+	q = &layers[l];
+	if (!q->retained)
+	{
+	    q->num = q->kept = 0;
+	    continue;
+	}
+	for (i = n = q->kept; i < q->num; i++)
+	{
+	    if ((q->type[i] & ~BLIT_CULLED) == 'D')
 	    {
+		q->src[n] = q->src[i];
+		q->srcrect[n] = q->srcrect[i];
+		q->dstrect[n] = q->dstrect[i];
+		q->type[n] = 'D';
+		n++;
+	    }
+	}
+	q->num = q->kept = n;
+    }
 
-		step1 = screen->w/segments;
-		step2 = step1/duration;
-
-		src.y = 0;
-		dst.y = 0;
-		src.h = screen->h;
-		dst.h = screen->h;
-		src.w = step2;
-		dst.w = step2;
+    *frame = *frame + 1;
+}
 
-		for(i = 0; i <= duration; i++)
-		{
-		    for(j = 0; j <= segments; j++)
-		    {
-			x1 = step1 * (j - 0.5) - i * step2 + 1;
-			x2 = step1 * (j - 0.5) + i * step2 + 1;
-			src.x = x1;
-			dst.x = x2;
-			SDL_BlitSurface((SDL_Surface*)newbkg, &src, screen, &src);
-			SDL_BlitSurface((SDL_Surface*)newbkg, &dst, screen, &dst);
-			T4K_AddRect(&src, &src);
-			T4K_AddRect(&dst, &dst);
-		    }
-		    SDL_Flip(screen);
-		    SDL_Delay(10);
-		}
 
-		src.x = 0;
-		src.y = 0;
-		src.w = screen->w;
-		src.h = screen->h;
-		SDL_BlitSurface((SDL_Surface*)newbkg, NULL, screen, &src);
-		SDL_Flip(screen);
+/* Redraw the retained part of a layer wherever it overlaps the first */
+/* n_damage rects touched this frame (i.e. by the layers below it).   */
+/* Each damaged pixel of a retained draw is redrawn exactly once.     */
+static void redraw_retained(struct blit_queue* q, int n_damage)
+{
+    SDL_Rect src, dst;
+    SDL_Rect* d;
+    SDL_Rect* r;
+    int i, j, n;
 
-		break;
-	    }
+    n = disjoint_damage(q, n_damage);
 
-	case WIPE_BLINDS_HORIZ:
-	    {
+    for (i = 0; i < q->kept; i++)
+    {
+	d = &q->dstrect[i];
+	for (j = 0; j < (n < 0 ? n_damage : n); j++)
+	{
+	    /* (add_blit_op() may move frame_rects, so look it up each time) */
+	    r = (n < 0) ? &frame_rects[j] : &damage_rects[j];
+	    if (!intersect_rects(d, r, &dst))
+		continue;
+
+	    src.x = q->srcrect[i].x + (dst.x - d->x);
+	    src.y = q->srcrect[i].y + (dst.y - d->y);
+	    src.w = dst.w;
+	    src.h = dst.h;
+	    /* (this also lets layers above this one see the redraw) */
+	    add_blit_op(q->src[i], &src, &dst);
+	}
+    }
+}
 
-		step1 = screen->h / segments;
-		step2 = step1 / duration;
 
-		src.x = 0;
-		dst.x = 0;
-		src.w = screen->w;
-		dst.w = screen->w;
-		src.h = step2;
-		dst.h = step2;
+/* Cut the first n_damage rects touched this frame into disjoint rects */
+/* covering the same pixels, leaving them in damage_rects. Only the    */
+/* area the retained draws of q cover is kept. Each rect is split      */
+/* against the disjoint rects found so far, and the pieces that miss   */
+/* all of them are added to the set. Returns the number of rects, or   */
+/* -1 if we ran out of memory (the caller then uses frame_rects as is). */
+static int disjoint_damage(struct blit_queue* q, int n_damage)
+{
+    struct damage_piece* p;
+    SDL_Rect* rects;
+    SDL_Rect box, a, r;
+    int i, j, k, n = 0, top, x1, y1, x2, y2;
+
+    /* bounding box of the retained draws, clipped to the screen: */
+    box = q->dstrect[0];
+    for (i = 1; i < q->kept; i++)
+    {
+	x1 = (box.x < q->dstrect[i].x) ? box.x : q->dstrect[i].x;
+	y1 = (box.y < q->dstrect[i].y) ? box.y : q->dstrect[i].y;
+	x2 = (box.x + box.w > q->dstrect[i].x + q->dstrect[i].w)
+	    ? box.x + box.w : q->dstrect[i].x + q->dstrect[i].w;
+	y2 = (box.y + box.h > q->dstrect[i].y + q->dstrect[i].h)
+	    ? box.y + box.h : q->dstrect[i].y + q->dstrect[i].h;
+	box.x = x1;
+	box.y = y1;
+	box.w = x2 - x1;
+	box.h = y2 - y1;
+    }
+    if (!clip_to_screen(&box))
+	return 0;
 
-		for(i = 0; i <= duration; i++)
-		{
-		    for(j = 0; j <= segments; j++)
-		    {
-			y1 = step1 * (j - 0.5) - i * step2 + 1;
-			y2 = step1 * (j - 0.5) + i * step2 + 1;
-			src.y = y1;
-			dst.y = y2;
-			SDL_BlitSurface((SDL_Surface*)newbkg, &src, screen, &src);
-			SDL_BlitSurface((SDL_Surface*)newbkg, &dst, screen, &dst);
-			T4K_AddRect(&src, &src);
-			T4K_AddRect(&dst, &dst);
-		    }
-		    SDL_Flip(screen);
-		    SDL_Delay(10);
-		}
+    for (j = 0; j < n_damage; j++)
+    {
+	if (!intersect_rects(&frame_rects[j], &box, &r))
+	    continue;
 
-		src.x = 0;
-		src.y = 0;
-		src.w = screen->w;
-		src.h = screen->h;
-		SDL_BlitSurface((SDL_Surface*)newbkg, NULL, screen, &src);
-		SDL_Flip(screen);
+	top = 0;
+	if (cap_damage_pieces < 1)
+	{
+	    p = realloc(damage_pieces, INITIAL_UPDATES * sizeof(struct damage_piece));
+	    if (!p)
+		return -1;
+	    damage_pieces = p;
+	    cap_damage_pieces = INITIAL_UPDATES;
+	}
+	damage_pieces[top].r = r;
+	damage_pieces[top++].next = 0;
 
-		break;
+	while (top > 0)
+	{
+	    top--;
+	    r = damage_pieces[top].r;
+	    for (k = damage_pieces[top].next; k < n; k++)
+	    {
+		a = damage_rects[k];
+		if (r.x < a.x + a.w && a.x < r.x + r.w
+			&& r.y < a.y + a.h && a.y < r.y + r.h)
+		    break;
 	    }
 
-	case WIPE_BLINDS_BOX:
+	    /* nothing overlaps this piece, so it joins the set: */
+	    if (k == n)
 	    {
-
-		step1 = screen->w/segments;
-		step2 = step1/duration;
-		step3 = screen->h/segments;
-		step4 = step1/duration;
-
-		for(i = 0; i <= duration; i++)
+		if (n >= cap_damage_rects)
 		{
-		    for(j = 0; j <= segments; j++)
-		    {
-			x1 = step1 * (j - 0.5) - i * step2 + 1;
-			x2 = step1 * (j - 0.5) + i * step2 + 1;
-			src.x = x1;
-			dst.x = x2;
-			dst.y = 0;
-			dst.w = step2;
-			dst.h = screen->h;
-			SDL_BlitSurface((SDL_Surface*)newbkg, &src, screen, &src);
-			SDL_BlitSurface((SDL_Surface*)newbkg, &dst, screen, &dst);
-			T4K_AddRect(&src, &src);
-			T4K_AddRect(&dst, &dst);
-
-			y1 = step3 * (j - 0.5) - i * step4 + 1;
-			y2 = step3 * (j - 0.5) + i * step4 + 1;
-			src.x = 0;
-			src.y = y1;
-			src.w = screen->w;
-			src.h = step4;
-			dst.x = 0;
-			dst.y = y2;
-			dst.w = screen->w;
-			dst.h = step4;
-			SDL_BlitSurface((SDL_Surface*)newbkg, &src, screen, &src);
-			SDL_BlitSurface((SDL_Surface*)newbkg, &dst, screen, &dst);
-			T4K_AddRect(&src, &src);
-			T4K_AddRect(&dst, &dst);
-		    }
-		    SDL_Flip(screen);
-		    SDL_Delay(10);
+		    i = cap_damage_rects ? cap_damage_rects * 2 : INITIAL_UPDATES;
+		    rects = realloc(damage_rects, i * sizeof(SDL_Rect));
+		    if (!rects)
+			return -1;
+		    damage_rects = rects;
+		    cap_damage_rects = i;
 		}
+		damage_rects[n++] = r;
+		continue;
+	    }
 
-		src.x = 0;
-		src.y = 0;
-		src.w = screen->w;
-		src.h = screen->h;
-		SDL_BlitSurface((SDL_Surface*)newbkg, NULL, screen, &src);
-		SDL_Flip(screen);
-
-		break;
+	    /* otherwise keep the (up to four) parts of it outside rect k: */
+	    if (top + 4 > cap_damage_pieces)
+	    {
+		p = realloc(damage_pieces, 2 * cap_damage_pieces * sizeof(struct damage_piece));
+		if (!p)
+		    return -1;
+		damage_pieces = p;
+		cap_damage_pieces *= 2;
 	    }
-	default:
-	    break;
+	    y1 = (r.y > a.y) ? r.y : a.y;
+	    y2 = (r.y + r.h < a.y + a.h) ? r.y + r.h : a.y + a.h;
+	    if (r.y < a.y)
+	    {
+		p = &damage_pieces[top++];
+		p->r.x = r.x;
+		p->r.y = r.y;
+		p->r.w = r.w;
+		p->r.h = a.y - r.y;
+		p->next = k + 1;
+	    }
+	    if (r.y + r.h > a.y + a.h)
+	    {
+		p = &damage_pieces[top++];
+		p->r.x = r.x;
+		p->r.y = a.y + a.h;
+		p->r.w = r.w;
+		p->r.h = r.y + r.h - (a.y + a.h);
+		p->next = k + 1;
+	    }
+	    if (r.x < a.x)
+	    {
+		p = &damage_pieces[top++];
+		p->r.x = r.x;
+		p->r.y = y1;
+		p->r.w = a.x - r.x;
+		p->r.h = y2 - y1;
+		p->next = k + 1;
+	    }
+	    if (r.x + r.w > a.x + a.w)
+	    {
+		p = &damage_pieces[top++];
+		p->r.x = a.x + a.w;
+		p->r.y = y1;
+		p->r.w = r.x + r.w - (a.x + a.w);
+		p->r.h = y2 - y1;
+		p->next = k + 1;
+	    }
+	}
     }
-    return 1;
-}
-
-
-
-
-
-
-/************************************************************************/
-/*                                                                      */
-/*        Begin blit queue support                                      */
-/*                                                                      */
-/* This code (modified from Sam Lantinga's "Alien" example program)     */
-/* implements a blit queue to perform screen updates in a more          */
-/* optimized fashion.                                                   */
-/************************************************************************/
 
-//With fullscreen, we need more updates - 180 wasn't enough
-#define MAX_UPDATES 512
+    return n;
+}
 
-/* --- Data Structure for Dirty Blitting --- */
-static SDL_Rect srcupdate[MAX_UPDATES];
-static SDL_Rect dstupdate[MAX_UPDATES];
-static int numupdates = 0; // tracks how many blits to be done
 
-struct blit {
-    SDL_Surface* src;
-    SDL_Rect* srcrect;
-    SDL_Rect* dstrect;
-    unsigned char type;
-} blits[MAX_UPDATES];
+/* Set out to the overlap of a and b. Returns 0 if they don't overlap. */
+static int intersect_rects(SDL_Rect* a, SDL_Rect* b, SDL_Rect* out)
+{
+    int x1 = (a->x > b->x) ? a->x : b->x;
+    int y1 = (a->y > b->y) ? a->y : b->y;
+    int x2 = (a->x + a->w < b->x + b->w) ? a->x + a->w : b->x + b->w;
+    int y2 = (a->y + a->h < b->y + b->h) ? a->y + a->h : b->y + b->h;
 
+    if (x1 >= x2 || y1 >= y2)
+	return 0;
+    out->x = x1;
+    out->y = y1;
+    out->w = x2 - x1;
+    out->h = y2 - y1;
+    return 1;
+}
 
 
-/***********************
-  T4K_InitBlitQueue()
- ***********************/
-void T4K_InitBlitQueue(void)
+/* Clip r to the screen's clip rect. Returns 0 if nothing is left. */
+static int clip_to_screen(SDL_Rect* r)
 {
-    int i;
+    SDL_Rect* c = &screen->clip_rect;
+    int x1 = (r->x > c->x) ? r->x : c->x;
+    int y1 = (r->y > c->y) ? r->y : c->y;
+    int x2 = (r->x + r->w < c->x + c->w) ? r->x + r->w : c->x + c->w;
+    int y2 = (r->y + r->h < c->y + c->h) ? r->y + r->h : c->y + c->h;
 
-    /* --- Set up the update rectangle pointers --- */
-    for (i = 0; i < MAX_UPDATES; ++i)
+    if (x1 >= x2 || y1 >= y2)
     {
-	blits[i].srcrect = &srcupdate[i];
-	blits[i].dstrect = &dstupdate[i];
+	r->w = r->h = 0;
+	return 0;
     }
-    numupdates = 0;
+    r->x = x1;
+    r->y = y1;
+    r->w = x2 - x1;
+    r->h = y2 - y1;
+    return 1;
 }
 
 
-/**************************
-  ResetBlitQueue(): just set the number
-  of pending updates to zero
- ***************************/
-void T4K_ResetBlitQueue(void)
+/* Flag the erases and draws queued this frame that are completely */
+/* hidden by an opaque draw done after them, so they can be skipped */
+static void cull_occluded(void)
 {
-    numupdates = 0;
-}
+    struct blit_queue* q;
+    struct occluder* o;
+    struct occluder* p;
+    SDL_Rect r;
+    int i, j, l, n = 0, checked = 0, hits = 0;
 
+    /* -- find the opaque draws (no per-surface alpha, alpha channel or colorkey) -- */
+    for (l = 0; l < T4K_NUM_LAYERS; l++)
+    {
+	q = &layers[l];
+	for (i = q->kept; i < q->num; i++)
+	{
+	    if (q->type[i] != 'D'
+		    || (q->src[i]->flags & (SDL_SRCALPHA | SDL_SRCCOLORKEY)))
+		continue;
+	    r = q->dstrect[i];
+	    if (!clip_to_screen(&r))
+		continue;
+
+	    if (n >= cap_occluders)
+	    {
+		j = cap_occluders ? cap_occluders * 2 : 16;
+		p = realloc(occluders, j * sizeof(struct occluder));
+		if (!p)
+		    break;
+		occluders = p;
+		cap_occluders = j;
+	    }
+	    occluders[n].r = r;
+	    occluders[n].layer = l;
+	    occluders[n].index = i;
+	    n++;
+	}
+    }
 
-/******************************
-AddRect : Don't actually blit a surface,
-but add a rect to be updated next
-update
- *******************************/
-int T4K_AddRect(SDL_Rect* src, SDL_Rect* dst)
-{
+    /* -- flag everything that one of them covers -- */
+    /* (with no opaque draws, there is nothing more to do) */
+    for (l = 0; n > 0 && l < T4K_NUM_LAYERS; l++)
+    {
+	q = &layers[l];
+	for (i = q->kept; i < q->num; i++)
+	{
+	    if (q->type[i] != 'D' && q->type[i] != 'E')
+		continue;
+	    checked++;
 
-    /*borrowed from SL's alien (and modified)*/
-    struct blit* update;
+	    r = q->dstrect[i];
+	    if (clip_to_screen(&r))
+	    {
+		for (j = 0; j < n; j++)
+		{
+		    o = &occluders[j];
+		    /* erases all happen before any draw; a draw has to be */
+		    /* covered by one that is done after it:               */
+		    if (q->type[i] == 'D'
+			    && (o->layer < l || (o->layer == l && o->index <= i)))
+			continue;
+		    if (r.x >= o->r.x && r.y >= o->r.y
+			    && r.x + r.w <= o->r.x + o->r.w
+			    && r.y + r.h <= o->r.y + o->r.h)
+			break;
+		}
+		if (j == n)
+		    continue;
+	    }
+	    q->type[i] |= BLIT_CULLED;
+	    hits++;
+	}
+    }
 
-    if(!src)
+    cull_checked += checked;
+    cull_hits += hits;
+    if (++cull_frames >= CULL_STATS_FRAMES)
     {
-	fprintf(stderr, "T4K_AddRect() - invalid 'src' arg!\n");
-	return 0;
+	DEBUGMSG(debug_sdl, "cull_occluded(): culled %ld of %ld queued blits (%.1f%%) over %d frames\n",
+		cull_hits, cull_checked,
+		cull_checked ? 100.0 * cull_hits / cull_checked : 0.0, cull_frames);
+	cull_checked = cull_hits = 0;
+	cull_frames = 0;
     }
+}
 
-    if(!dst)
+/* Clip a blit of srcrect of src to (dstrect->x, dstrect->y) on dst */
+/* to the source surface and dst's clip rect the way                */
+/* SDL_BlitSurface() would, leaving what is left in both rects.     */
+/* Returns 0 if nothing is.                                         */
+static int clip_blit(SDL_Surface* src, SDL_Rect* srcrect, SDL_Surface* dst, SDL_Rect* dstrect)
+{
+    SDL_Rect* c = &dst->clip_rect;
+    int sx = srcrect->x, sy = srcrect->y, w = srcrect->w, h = srcrect->h;
+    int dx = dstrect->x, dy = dstrect->y;
+
+    /* -- clip to the source surface -- */
+    if (sx < 0)
     {
-	fprintf(stderr, "T4K_AddRect() - invalid 'dst' arg!\n");
-	return 0;
+	w += sx;
+	dx -= sx;
+	sx = 0;
     }
-
-    if(numupdates >= MAX_UPDATES)
+    if (sy < 0)
     {
-	fprintf(stderr, "Warning - MAX_UPDATES exceeded, cannot add blit to queue\n");
-	return 0;
+	h += sy;
+	dy -= sy;
+	sy = 0;
     }
+    if (sx + w > src->w)
+	w = src->w - sx;
+    if (sy + h > src->h)
+	h = src->h - sy;
 
-    update = &blits[numupdates++];
-
-    if(!update || !update->srcrect || !update->dstrect)
+    /* -- clip to the screen -- */
+    if (dx < c->x)
     {
-	fprintf(stderr, "T4K_AddRect() - 'update' ptr invalid!\n");
-	return 0;
+	w -= c->x - dx;
+	sx += c->x - dx;
+	dx = c->x;
+    }
+    if (dy < c->y)
+    {
+	h -= c->y - dy;
+	sy += c->y - dy;
+	dy = c->y;
     }
+    if (dx + w > c->x + c->w)
+	w = c->x + c->w - dx;
+    if (dy + h > c->y + c->h)
+	h = c->y + c->h - dy;
 
-    update->srcrect->x = src->x;
-    update->srcrect->y = src->y;
-    update->srcrect->w = src->w;
-    update->srcrect->h = src->h;
-    update->dstrect->x = dst->x;
-    update->dstrect->y = dst->y;
-    update->dstrect->w = dst->w;
-    update->dstrect->h = dst->h;
-    update->type = 'I';
+    if (w <= 0 || h <= 0)
+	return 0;
 
+    srcrect->x = sx;
+    srcrect->y = sy;
+    srcrect->w = dstrect->w = w;
+    srcrect->h = dstrect->h = h;
+    dstrect->x = dx;
+    dstrect->y = dy;
     return 1;
 }
 
+/* Clip a blit to the source surface and the screen, and add it to the */
+/* list for this frame. The clipped rect is added to the frame's        */
+/* touched rects                                                         */
+static void add_blit_op(SDL_Surface* src, SDL_Rect* srcrect, SDL_Rect* dstrect)
+{
+    struct blit_op* op;
+    SDL_Rect s = *srcrect;
+    SDL_Rect d = *dstrect;
+    int n;
 
+    if (!clip_blit(src, &s, screen, &d))
+	return;
 
-int T4K_DrawSprite(sprite* gfx, int x, int y)
-{
-    if (!gfx || !gfx->frame[gfx->cur])
+    if (num_blit_ops >= cap_blit_ops)
     {
-	fprintf(stderr, "T4K_DrawSprite() - 'gfx' arg invalid!\n");
-	return 0;
+	n = cap_blit_ops ? cap_blit_ops * 2 : INITIAL_UPDATES;
+	op = realloc(blit_ops, n * sizeof(struct blit_op));
+	if (!op)
+	{
+	    fprintf(stderr, "Warning - could not grow blit list, blit will not be done\n");
+	    return;
+	}
+	blit_ops = op;
+	cap_blit_ops = n;
     }
-    return T4K_DrawObject(gfx->frame[gfx->cur], x, y);
-}
 
+    op = &blit_ops[num_blit_ops++];
+    op->src = src;
+    op->srcrect = s;
+    op->dstrect = d;
+    blit_ops_area += (long)d.w * d.h;
 
+    add_frame_rect(&op->dstrect);
+}
 
-/**********************
-DrawObject : Draw an object at the specified
-location. No respect to clipping!
- *************************/
-int T4K_DrawObject(SDL_Surface* surf, int x, int y)
+
+/* Do this frame's blits, spread over the worker pool if it pays */
+static void run_blit_ops(void)
 {
-    struct blit *update;
+    SDL_Rect none_src = {0, 0, 0, 0};
+    SDL_Rect none_dst = {0, 0, 0, 0};
+    SDL_Rect s, d;
+    int i, nbands;
+
+    if (blit_threads > 1
+	    && blit_ops_area >= blit_thread_area
+	    && !SDL_MUSTLOCK(screen))
+    {
+	/* Surfaces that have to be locked (e.g. RLE encoded ones) can't */
+	/* be blitted from several threads at once. Also, SDL works out  */
+	/* how to blit a surface to the screen the first time it's asked */
+	/* to, which isn't thread safe either - so do that here with an  */
+	/* empty blit.                                                   */
+	for (i = 0; i < num_blit_ops; i++)
+	{
+	    if (SDL_MUSTLOCK(blit_ops[i].src)
+		    || (blit_ops[i].src->flags & SDL_RLEACCELOK))
+		break;
+	    SDL_LowerBlit(blit_ops[i].src, &none_src, screen, &none_dst);
+	}
 
-    if (!surf)
-    {
-	fprintf(stderr, "T4K_DrawObject() - invalid 'surf' arg!\n");
-	return 0;
+	if (i == num_blit_ops)
+	{
+	    nbands = blit_threads;
+	    if (nbands > screen->h / MIN_BAND_ROWS)
+		nbands = screen->h / MIN_BAND_ROWS;
+	    /* (a screen shorter than one band still gets one) */
+	    if (nbands < 1)
+		nbands = 1;
+	    pool_run(blit_band, NULL, nbands);
+	    return;
+	}
     }
 
-    if(numupdates >= MAX_UPDATES)
+    for (i = 0; i < num_blit_ops; i++)
     {
-	fprintf(stderr, "Warning - MAX_UPDATES exceeded, cannot add blit to queue\n");
-	return 0;
+	s = blit_ops[i].srcrect;
+	d = blit_ops[i].dstrect;
+	blit_to_screen(blit_ops[i].src, &s, &d);
     }
+}
 
-    update = &blits[numupdates++];
 
-    if(!update || !update->srcrect || !update->dstrect)
-    {
-	fprintf(stderr, "T4K_DrawObject() - 'update' ptr invalid!\n");
-	return 0;
+/* SDL_LowerBlit() to the screen, or our own for premultiplied surfaces */
+static void blit_to_screen(SDL_Surface* src, SDL_Rect* s, SDL_Rect* d)
+{
+    if (is_premultiplied(src))
+	blit_premultiplied(src, s, screen, d);
+    else
+	SDL_LowerBlit(src, s, screen, d);
+}
+
+
+/* Do the part of every blit in the list that falls in one band of the screen */
+static void blit_band(void* arg, int band, int nbands)
+{
+    struct blit_op* op;
+    SDL_Rect s, d;
+    int i, top, bottom, y1, y2;
+
+    top = screen->h * band / nbands;
+    bottom = screen->h * (band + 1) / nbands;
+
+    /* erases and draws are in order in the list, so they stay */
+    /* in the same order within each band:                     */
+    for (i = 0; i < num_blit_ops; i++)
+    {
+	op = &blit_ops[i];
+	y1 = (op->dstrect.y > top) ? op->dstrect.y : top;
+	y2 = (op->dstrect.y + op->dstrect.h < bottom) ? op->dstrect.y + op->dstrect.h : bottom;
+	if (y1 >= y2)
+	    continue;
+
+	s = op->srcrect;
+	d = op->dstrect;
+	s.y += y1 - d.y;
+	s.h = d.h = y2 - y1;
+	d.y = y1;
+	blit_to_screen(op->src, &s, &d);
     }
+}
 
-    update->src = surf;
-    update->srcrect->x = 0;
-    update->srcrect->y = 0;
-    update->srcrect->w = surf->w;
-    update->srcrect->h = surf->h;
-    update->dstrect->x = x;
-    update->dstrect->y = y;
-    update->dstrect->w = surf->w;
-    update->dstrect->h = surf->h;
-    update->type = 'D';
 
-    return 1;
+/************************
+SetBlitThreads : Set how many threads T4K_UpdateScreen()
+may use to do the queued blits
+ ***************************/
+void T4K_SetBlitThreads(int n)
+{
+    if (n < 0)
+	n = pool_cpu_count();
+    if (n > 1)
+	n = pool_reserve(n);
+    if (n < 1)
+	n = 1;
+    blit_threads = n;
+    DEBUGMSG(debug_sdl, "T4K_SetBlitThreads(): compositing with %d threads\n", blit_threads);
 }
 
 
+/************************
+SetBlitThreadArea : Set how many pixels a frame has to
+blit before T4K_UpdateScreen() uses several threads
+ ***************************/
+void T4K_SetBlitThreadArea(int pixels)
+{
+    if (pixels < 0)
+	pixels = 0;
+    blit_thread_area = pixels;
+}
+
 
 /************************
-UpdateScreen : Update the screen and increment the frame num
+SetFullUpdateFraction : Set how much of the screen may be dirty
+before T4K_UpdateScreen() gives up on coalescing rects
  ***************************/
-void T4K_UpdateScreen(int* frame)
+void T4K_SetFullUpdateFraction(float fraction)
 {
-    int i;
+    if (fraction < 0)
+	fraction = 0;
+    if (fraction > 1)
+	fraction = 1;
+    full_update_fraction = fraction;
+}
 
-    /* -- First erase everything we need to -- */
-    for (i = 0; i < numupdates; i++)
+
+/* (re)allocate the tile grid and rect buffers if the screen size changed */
+static int alloc_dirty_tiles(void)
+{
+    int w = (screen->w + UPDATE_TILE - 1) / UPDATE_TILE;
+    int h = (screen->h + UPDATE_TILE - 1) / UPDATE_TILE;
+
+    if (dirty_tiles && w == tiles_w && h == tiles_h)
+	return 1;
+
+    free(dirty_tiles);
+    free(merged_rects);
+    free(open_rects);
+    free(next_open_rects);
+    dirty_tiles = malloc(w * h);
+    merged_rects = malloc(w * h * sizeof(SDL_Rect));
+    open_rects = malloc(w * sizeof(int));
+    next_open_rects = malloc(w * sizeof(int));
+
+    if (!dirty_tiles || !merged_rects || !open_rects || !next_open_rects)
+    {
+	fprintf(stderr, "alloc_dirty_tiles() - could not allocate tile grid\n");
+	free(dirty_tiles);
+	free(merged_rects);
+	free(open_rects);
+	free(next_open_rects);
+	dirty_tiles = NULL;
+	merged_rects = NULL;
+	open_rects = NULL;
+	next_open_rects = NULL;
+	tiles_w = tiles_h = 0;
+	return 0;
+    }
+
+    tiles_w = w;
+    tiles_h = h;
+    return 1;
+}
+
+
+/* Merge the (possibly overlapping) update rects into a set of disjoint */
+/* rects covering the same tiles, and send those to the display.        */
+/* Returns the number of pixels updated.                                */
+static long update_dirty_rects(SDL_Rect* rects, int n)
+{
+    int i, tx, ty, x0, y0, x1, y1;
+    int n_merged = 0;
+    int n_open = 0, n_next_open, j;
+    int* swap;
+    int dirty = 0;
+    long area = 0;
+    Uint8* row;
+
+    if (n <= 0)
+	return 0;
+
+    if (!alloc_dirty_tiles())
     {
-	if (blits[i].type == 'E')
+	SDL_UpdateRect(screen, 0, 0, 0, 0);
+	return (long)screen->w * screen->h;
+    }
+
+    memset(dirty_tiles, 0, tiles_w * tiles_h);
+
+    /* Mark every tile touched by a rect, clipping to the screen: */
+    for (i = 0; i < n; i++)
+    {
+	x0 = rects[i].x;
+	y0 = rects[i].y;
+	x1 = x0 + rects[i].w;
+	y1 = y0 + rects[i].h;
+	if (x0 < 0)
+	    x0 = 0;
+	if (y0 < 0)
+	    y0 = 0;
+	if (x1 > screen->w)
+	    x1 = screen->w;
+	if (y1 > screen->h)
+	    y1 = screen->h;
+	if (x0 >= x1 || y0 >= y1)
+	    continue;
+
+	x0 /= UPDATE_TILE;
+	y0 /= UPDATE_TILE;
+	x1 = (x1 - 1) / UPDATE_TILE;
+	y1 = (y1 - 1) / UPDATE_TILE;
+	for (ty = y0; ty <= y1; ty++)
 	{
-	    //       DEBUGCODE(debug_sdl)
-	    //       {
-	    //         fprintf(stderr, "Erasing blits[%d]\n", i);
-	    //         fprintf(stderr, "srcrect->x = %d\t srcrect->y = %d\t srcrect->w = %d\t srcrect->h = %d\n",
-	    //               blits[i].srcrect->x, blits[i].srcrect->y, blits[i].srcrect->w, blits[i].srcrect->h);
-	    //         fprintf(stderr, "dstrect->x = %d\t dstrect->y = %d\t dstrect->w = %d\t dstrect->h = %d\n",
-	    //               blits[i].dstrect->x, blits[i].dstrect->y, blits[i].dstrect->w, blits[i].dstrect->h);
-	    //       }
-
-	    SDL_LowerBlit(blits[i].src, blits[i].srcrect, screen, blits[i].dstrect);
+	    row = dirty_tiles + ty * tiles_w;
+	    for (tx = x0; tx <= x1; tx++)
+	    {
+		dirty += !row[tx];
+		row[tx] = 1;
+	    }
 	}
     }
 
-    //  SNOW_erase();
+    if (dirty == 0)
+	return 0;
 
-    /* -- then draw -- */
-    for (i = 0; i < numupdates; i++)
+    /* Not worth the trouble - just update everything: */
+    if ((float)dirty * UPDATE_TILE * UPDATE_TILE
+	    > full_update_fraction * screen->w * screen->h)
     {
-	if (blits[i].type == 'D')
+	SDL_UpdateRect(screen, 0, 0, 0, 0);
+	return (long)screen->w * screen->h;
+    }
+
+    /* Scan each tile row for runs of dirty tiles. A run that spans the */
+    /* same columns as a rect ending on the row above extends that rect */
+    /* downwards; otherwise it starts a new rect. Both the runs and the */
+    /* open rects are ordered left to right, so one pass per row finds  */
+    /* the matches. The rects left open by this row are collected in a */
+    /* separate buffer, since the ones from the row above are still     */
+    /* being read, and the two buffers trade places after each row.     */
+    for (ty = 0; ty < tiles_h; ty++)
+    {
+	row = dirty_tiles + ty * tiles_w;
+	n_next_open = 0;
+	j = 0;
+	tx = 0;
+	while (tx < tiles_w)
 	{
-	    //       DEBUGCODE(debug_sdl)
-	    //       {
-	    //         fprintf(stderr, "drawing blits[%d]\n", i);
-	    //         fprintf(stderr, "srcrect->x = %d\t srcrect->y = %d\t srcrect->w = %d\t srcrect->h = %d\n",
-	    //               blits[i].srcrect->x, blits[i].srcrect->y, blits[i].srcrect->w, blits[i].srcrect->h);
-	    //         fprintf(stderr, "dstrect->x = %d\t dstrect->y = %d\t dstrect->w = %d\t dstrect->h = %d\n",
-	    //               blits[i].dstrect->x, blits[i].dstrect->y, blits[i].dstrect->w, blits[i].dstrect->h);
-	    //       }
-
-	    SDL_BlitSurface(blits[i].src, blits[i].srcrect, screen, blits[i].dstrect);
+	    if (!row[tx])
+	    {
+		tx++;
+		continue;
+	    }
+	    x0 = tx;
+	    while (tx < tiles_w && row[tx])
+		tx++;
+
+	    /* skip open rects lying entirely to the left of this run: */
+	    while (j < n_open
+		    && merged_rects[open_rects[j]].x < x0 * UPDATE_TILE)
+		j++;
+
+	    if (j < n_open
+		    && merged_rects[open_rects[j]].x == x0 * UPDATE_TILE
+		    && merged_rects[open_rects[j]].w == (tx - x0) * UPDATE_TILE)
+	    {
+		merged_rects[open_rects[j]].h += UPDATE_TILE;
+		next_open_rects[n_next_open++] = open_rects[j++];
+	    }
+	    else
+	    {
+		merged_rects[n_merged].x = x0 * UPDATE_TILE;
+		merged_rects[n_merged].y = ty * UPDATE_TILE;
+		merged_rects[n_merged].w = (tx - x0) * UPDATE_TILE;
+		merged_rects[n_merged].h = UPDATE_TILE;
+		next_open_rects[n_next_open++] = n_merged++;
+	    }
 	}
+	swap = open_rects;
+	open_rects = next_open_rects;
+	next_open_rects = swap;
+	n_open = n_next_open;
     }
 
-    //  SNOW_draw();
+    /* The last row and column of tiles may hang off the screen: */
+    for (i = 0; i < n_merged; i++)
+    {
+	if (merged_rects[i].x + merged_rects[i].w > screen->w)
+	    merged_rects[i].w = screen->w - merged_rects[i].x;
+	if (merged_rects[i].y + merged_rects[i].h > screen->h)
+	    merged_rects[i].h = screen->h - merged_rects[i].y;
+	area += (long)merged_rects[i].w * merged_rects[i].h;
+    }
 
-    /* -- update the screen only where we need to! -- */
-    //  if (SNOW_on)
-    //    SDL_UpdateRects(screen, SNOW_add( (SDL_Rect*)&dstupdate, numupdates ), SNOW_rects);
-    //  else
-    SDL_UpdateRects(screen, numupdates, dstupdate);
+    DEBUGMSG(debug_sdl, "update_dirty_rects(): %d rects coalesced into %d\n",
+	    n, n_merged);
 
-    numupdates = 0;
-    *frame = *frame + 1;
+    SDL_UpdateRects(screen, n_merged, merged_rects);
+    return area;
 }
 
 
 /* basically puts in an order to overdraw sprite with corresponding */
 /* rect of bkgd img                                                 */
 int T4K_EraseSprite(sprite* img, SDL_Surface* curr_bkgd, int x, int y)
+{
+    return T4K_EraseSpriteOnLayer(img, curr_bkgd, x, y, T4K_LAYER_SPRITES);
+}
+
+
+int T4K_EraseSpriteOnLayer(sprite* img, SDL_Surface* curr_bkgd, int x, int y, int layer)
 {
     if( !img
 	    || img->cur < 0
@@ -1172,7 +3095,7 @@ int T4K_EraseSprite(sprite* img, SDL_Surface* curr_bkgd, int x, int y)
 	fprintf(stderr, "T4K_EraseSprite() - invalid 'img' arg!\n");
 	return 0;
     }
-    return T4K_EraseObject(img->frame[img->cur], curr_bkgd, x, y);
+    return T4K_EraseObjectOnLayer(img->frame[img->cur], curr_bkgd, x, y, layer);
 }
 
 
@@ -1182,7 +3105,15 @@ EraseObject : Erase an object from the screen
  **************************/
 int T4K_EraseObject(SDL_Surface* surf, SDL_Surface* curr_bkgd, int x, int y)
 {
-    struct blit* update = NULL;
+    return T4K_EraseObjectOnLayer(surf, curr_bkgd, x, y, T4K_LAYER_SPRITES);
+}
+
+
+int T4K_EraseObjectOnLayer(SDL_Surface* surf, SDL_Surface* curr_bkgd, int x, int y, int layer)
+{
+    struct blit_queue* q;
+    SDL_Rect* srcrect;
+    int i;
 
     if(!surf)
     {
@@ -1190,61 +3121,50 @@ int T4K_EraseObject(SDL_Surface* surf, SDL_Surface* curr_bkgd, int x, int y)
 	return 0;
     }
 
-    if(numupdates >= MAX_UPDATES)
-    {
-	fprintf(stderr, "Warning - MAX_UPDATES exceeded, cannot add blit to queue\n");
-	return 0;
-    }
-
-    update = &blits[numupdates++];
-
-    if(!update || !update->srcrect || !update->dstrect)
-    {
-	fprintf(stderr, "T4K_EraseObject() - 'update' ptr invalid!\n");
+    i = queue_blit(layer);
+    if(i < 0)
 	return 0;
-    }
+    q = &layers[layer];
 
-    update->src = curr_bkgd;
+    q->src[i] = curr_bkgd;
+    srcrect = &q->srcrect[i];
 
     /* take dimentsions from src surface: */
-    update->srcrect->x = x;
-    update->srcrect->y = y;
-    update->srcrect->w = surf->w;
-    update->srcrect->h = surf->h;
+    srcrect->x = x;
+    srcrect->y = y;
+    srcrect->w = surf->w;
+    srcrect->h = surf->h;
 
     /* NOTE this is needed because the letters may go beyond the size of */
     /* the fish, and we only erase the fish image before we redraw the   */
     /* fish followed by the letter - DSB                                 */
     /* add margin of a few pixels on each side: */
-    update->srcrect->x -= ERASE_MARGIN;
-    update->srcrect->y -= ERASE_MARGIN;
-    update->srcrect->w += (ERASE_MARGIN * 2);
-    update->srcrect->h += (ERASE_MARGIN * 2);
+    srcrect->x -= ERASE_MARGIN;
+    srcrect->y -= ERASE_MARGIN;
+    srcrect->w += (ERASE_MARGIN * 2);
+    srcrect->h += (ERASE_MARGIN * 2);
 
 
     /* Adjust srcrect so it doesn't go past bkgd: */
-    if (update->srcrect->x < 0)
+    if (srcrect->x < 0)
     {
-	update->srcrect->w += update->srcrect->x; //so right edge stays correct
-	update->srcrect->x = 0;
+	srcrect->w += srcrect->x; //so right edge stays correct
+	srcrect->x = 0;
     }
-    if (update->srcrect->y < 0)
+    if (srcrect->y < 0)
     {
-	update->srcrect->h += update->srcrect->y; //so bottom edge stays correct
-	update->srcrect->y = 0;
+	srcrect->h += srcrect->y; //so bottom edge stays correct
+	srcrect->y = 0;
     }
 
-    if (update->srcrect->x + update->srcrect->w > curr_bkgd->w)
-	update->srcrect->w = curr_bkgd->w - update->srcrect->x;
-    if (update->srcrect->y + update->srcrect->h > curr_bkgd->h)
-	update->srcrect->h = curr_bkgd->h - update->srcrect->y;
+    if (srcrect->x + srcrect->w > curr_bkgd->w)
+	srcrect->w = curr_bkgd->w - srcrect->x;
+    if (srcrect->y + srcrect->h > curr_bkgd->h)
+	srcrect->h = curr_bkgd->h - srcrect->y;
 
 
-    update->dstrect->x = update->srcrect->x;
-    update->dstrect->y = update->srcrect->y;
-    update->dstrect->w = update->srcrect->w;
-    update->dstrect->h = update->srcrect->h;
-    update->type = 'E';
+    q->dstrect[i] = *srcrect;
+    q->type[i] = 'E';
 
     return 1;
 }
@@ -1282,6 +3202,7 @@ TTF_Font* font_list[MAX_FONT_SIZE + 1] = {NULL};
 static void free_font_list(void);
 static TTF_Font* get_font(int size);
 static TTF_Font* load_font(const char* font_name, int font_size);
+static unsigned long font_hits = 0, font_misses = 0;
 #endif
 
 
@@ -1320,6 +3241,19 @@ int T4K_Setup_SDL_Text(void)
 
 
 
+/* How often a font was already loaded when asked for (SDL_ttf only) */
+void text_cache_stats(unsigned long* hits, unsigned long* misses)
+{
+#if HAVE_LIBSDL_PANGO
+    *hits = *misses = 0;
+#else
+    *hits = font_hits;
+    *misses = font_misses;
+#endif
+}
+
+
+
 void T4K_Cleanup_SDL_Text(void)
 {
 #if HAVE_LIBSDL_PANGO
@@ -1715,7 +3649,12 @@ static TTF_Font* get_font(int size)
     }
 
     if(font_list[size] == NULL)
+    {
+	font_misses++;
 	font_list[size] = load_font(DEFAULT_FONT_NAME, size);
+    }
+    else
+	font_hits++;
     return font_list[size];
 }
 
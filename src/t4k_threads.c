@@ -0,0 +1,218 @@
+/*
+   t4k_threads.c
+
+   A small pool of worker threads, used to split big pixel jobs
+   (blitting, scaling) into horizontal bands that are done in parallel.
+
+   Copyright 2010.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+t4k_threads.c is part of the t4k_common library.
+
+t4k_common is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+t4k_common is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "t4k_globals.h"
+#include "SDL.h"
+
+#ifdef WIN32
+#   undef DATADIR
+#   include <windows.h>
+#else
+#   include <unistd.h>
+#endif /* WIN32 */
+
+/* The thread calling pool_run() works on the job too, so a pool of */
+/* n threads has n - 1 workers.                                     */
+#define MAX_POOL_THREADS 16
+
+static SDL_Thread* workers[MAX_POOL_THREADS];
+static int num_workers = 0;
+
+/* Everything below is protected by pool_lock: */
+static SDL_mutex* pool_lock = NULL;
+static SDL_cond* work_cond = NULL;  // signalled when a job is posted
+static SDL_cond* done_cond = NULL;  // signalled when the last band is done
+static PoolJob job = NULL;
+static void* job_arg = NULL;
+static int job_bands = 0;
+static int next_band = 0;
+static int bands_done = 0;
+static int quitting = 0;
+static int busy = 0;        // a job is running
+
+static int pool_worker(void* data);
+static void pool_do_bands(void);
+
+
+
+/* How many CPUs we have, or 1 if we can't tell */
+int pool_cpu_count(void)
+{
+    int n = 1;
+#if defined(WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    n = info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (n < 1)
+	n = 1;
+    return n;
+}
+
+
+/* Make sure the pool has at least n threads (counting the caller's). */
+/* Returns the number of threads pool_run() will actually use.        */
+int pool_reserve(int n)
+{
+    if (n > MAX_POOL_THREADS)
+	n = MAX_POOL_THREADS;
+
+    if (!pool_lock)
+    {
+	pool_lock = SDL_CreateMutex();
+	work_cond = SDL_CreateCond();
+	done_cond = SDL_CreateCond();
+	if (!pool_lock || !work_cond || !done_cond)
+	{
+	    fprintf(stderr, "pool_reserve() - could not create mutex: %s\n", SDL_GetError());
+	    pool_shutdown();
+	    return 1;
+	}
+    }
+
+    while (num_workers < n - 1)
+    {
+	workers[num_workers] = SDL_CreateThread(pool_worker, NULL);
+	if (!workers[num_workers])
+	{
+	    fprintf(stderr, "pool_reserve() - could not create thread: %s\n", SDL_GetError());
+	    break;
+	}
+	num_workers++;
+    }
+
+    DEBUGMSG(debug_sdl, "pool_reserve(): %d worker threads running\n", num_workers);
+    return num_workers + 1;
+}
+
+
+/* Run job(arg, band, nbands) for every band in 0..nbands-1, spread   */
+/* over the pool, and return once all of them are done. The bands may */
+/* run in any order and at the same time, so each one has to touch   */
+/* only its own part of the output. If the pool is already busy with  */
+/* a job from another thread, the bands are just run by the caller.   */
+void pool_run(PoolJob fn, void* arg, int nbands)
+{
+    int i;
+
+    if (num_workers > 0 && nbands > 1)
+    {
+	SDL_mutexP(pool_lock);
+	if (!busy)
+	{
+	    busy = 1;
+	    job = fn;
+	    job_arg = arg;
+	    job_bands = nbands;
+	    next_band = 0;
+	    bands_done = 0;
+	    SDL_CondBroadcast(work_cond);
+
+	    /* pitch in rather than just wait: */
+	    pool_do_bands();
+	    while (bands_done < job_bands)
+		SDL_CondWait(done_cond, pool_lock);
+	    busy = 0;
+	    SDL_mutexV(pool_lock);
+	    return;
+	}
+	SDL_mutexV(pool_lock);
+    }
+
+    for (i = 0; i < nbands; i++)
+	fn(arg, i, nbands);
+}
+
+
+/* Stop and free all the workers */
+void pool_shutdown(void)
+{
+    int i;
+
+    if (pool_lock)
+    {
+	SDL_mutexP(pool_lock);
+	quitting = 1;
+	SDL_CondBroadcast(work_cond);
+	SDL_mutexV(pool_lock);
+    }
+
+    for (i = 0; i < num_workers; i++)
+	SDL_WaitThread(workers[i], NULL);
+    num_workers = 0;
+    quitting = 0;
+
+    if (done_cond)
+	SDL_DestroyCond(done_cond);
+    if (work_cond)
+	SDL_DestroyCond(work_cond);
+    if (pool_lock)
+	SDL_DestroyMutex(pool_lock);
+    done_cond = work_cond = NULL;
+    pool_lock = NULL;
+}
+
+
+/* Take bands from the current job until there are none left. */
+/* Called, and returns, with pool_lock held.                   */
+static void pool_do_bands(void)
+{
+    PoolJob fn;
+    void* arg;
+    int band, nbands;
+
+    while (next_band < job_bands)
+    {
+	fn = job;
+	arg = job_arg;
+	band = next_band++;
+	nbands = job_bands;
+
+	SDL_mutexV(pool_lock);
+	fn(arg, band, nbands);
+	SDL_mutexP(pool_lock);
+
+	if (++bands_done == job_bands)
+	    SDL_CondSignal(done_cond);
+    }
+}
+
+
+static int pool_worker(void* data)
+{
+    SDL_mutexP(pool_lock);
+    while (!quitting)
+    {
+	if (next_band < job_bands)
+	    pool_do_bands();
+	else
+	    SDL_CondWait(work_cond, pool_lock);
+    }
+    SDL_mutexV(pool_lock);
+    return 0;
+}
@@ -2,7 +2,8 @@
    t4k_throttle.c:
 
    A simple function that uses SDL_Delay() to keep loops from eating
-   all available CPU.
+   all available CPU, and a frame scheduler that keeps loops to an
+   exact frame rate using the system's high resolution clock.
 
    Copyright 2009, 2010.
 Author: David Bruce
@@ -28,12 +29,25 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "t4k_globals.h"
 #include "SDL.h"
+#include <time.h>
+#include <errno.h>
+
+/* Sleep until this close (in nsec) to a deadline, then spin the rest */
+/* of the way, as sleeps can overshoot by tens to hundreds of usec:   */
+#define SPIN_NS 500000
+/* Most fixed updates to run in one frame before giving up on catching */
+/* up (so a slow machine runs the game slower instead of stalling):    */
+#define MAX_CATCHUP_STEPS 5
+
+static void sleep_ns(Uint64 ns);
+static void wait_until(Uint64 deadline);
 
 /* NOTE now store the time elsewhere to make function thread-safe                          */
 
 void T4K_Throttle(int loop_msec, Uint32* last_t)
 {
-    Uint32 now_t, wait_t;
+    Uint32 now_t;
+    Sint32 wait_t;
 
     if(!last_t)
 	return;
@@ -44,17 +58,156 @@ void T4K_Throttle(int loop_msec, Uint32* last_t)
     if(loop_msec > 1000)
 	loop_msec = 1000;
 
-    //See if we need to wait:
+    //See if we need to wait (the signed difference stays right
+    //even when the ticks wrap past uint32 size at 49.7 days):
     now_t = SDL_GetTicks();
-    if (now_t < (*last_t + loop_msec))
+    wait_t = (Sint32)(*last_t + loop_msec - now_t);
+    if(wait_t > loop_msec)
+	wait_t = loop_msec;
+    if(wait_t > 0)
+	wait_until(T4K_GetTimeNS() + (Uint64)wait_t * 1000000);
+    *last_t = SDL_GetTicks();
+}
+
+
+/* Monotonic time in nanoseconds, from an arbitrary starting point */
+Uint64 T4K_GetTimeNS(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	return (Uint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return (Uint64)SDL_GetTicks() * 1000000;
+}
+
+
+/* Set up fs to run frames_per_sec frames, and updates_per_sec fixed */
+/* updates (0 for one update per frame), starting now.                */
+void T4K_InitFrameScheduler(T4K_FrameScheduler* fs, int frames_per_sec, int updates_per_sec)
+{
+    if (!fs)
+	return;
+
+    if (frames_per_sec < 1)
+	frames_per_sec = 1;
+    if (updates_per_sec < 0)
+	updates_per_sec = 0;
+
+    fs->frame_ns = 1000000000 / frames_per_sec;
+    fs->step_ns = updates_per_sec ? 1000000000 / updates_per_sec : 0;
+    fs->last_ns = T4K_GetTimeNS();
+    fs->next_ns = fs->last_ns + fs->frame_ns;
+    fs->accum_ns = 0;
+    fs->late_ns = 0;
+    fs->frames = 0;
+    fs->overruns = 0;
+}
+
+
+/* How many fixed updates to run this frame, for the time since the */
+/* last call. Time left over is carried over to the next frame.     */
+int T4K_FrameUpdates(T4K_FrameScheduler* fs)
+{
+    Uint64 now;
+    int n;
+
+    if (!fs)
+	return 0;
+
+    now = T4K_GetTimeNS();
+    fs->accum_ns += now - fs->last_ns;
+    fs->last_ns = now;
+
+    if (!fs->step_ns)
     {
-	wait_t = (*last_t + loop_msec) - now_t;
-	//Avoid problem if we somehow wrap past uint32 size (at 49.7 days!)
-	if(wait_t < 0)
-	    wait_t = 0;
-	if(wait_t > loop_msec)
-	    wait_t = loop_msec;
-	SDL_Delay(wait_t);
+	fs->accum_ns = 0;
+	return 1;
     }
-    *last_t = SDL_GetTicks();
+
+    n = fs->accum_ns / fs->step_ns;
+    if (n > MAX_CATCHUP_STEPS)
+    {
+	DEBUGMSG(debug_sdl, "T4K_FrameUpdates(): %d updates behind, dropping %d\n",
+		n, n - MAX_CATCHUP_STEPS);
+	n = MAX_CATCHUP_STEPS;
+	fs->accum_ns %= fs->step_ns;
+    }
+    else
+	fs->accum_ns -= n * fs->step_ns;
+    return n;
+}
+
+
+/* How far (0 to 1) we are between the last fixed update and the */
+/* next, for drawing positions in between.                       */
+float T4K_FrameAlpha(T4K_FrameScheduler* fs)
+{
+    if (!fs || !fs->step_ns)
+	return 1;
+    return (float)fs->accum_ns / fs->step_ns;
+}
+
+
+/* Wait for the end of the frame. Deadlines are kept a whole number  */
+/* of frames from the start, so short or long frames don't make the */
+/* rate drift; a frame that ends more than a frame late starts the   */
+/* schedule over from now instead of rushing to catch up.            */
+int T4K_FrameWait(T4K_FrameScheduler* fs)
+{
+    Uint64 now;
+    int late = 0;
+
+    if (!fs)
+	return 0;
+
+    now = T4K_GetTimeNS();
+    if (now > fs->next_ns)
+    {
+	late = 1;
+	fs->late_ns = now - fs->next_ns;
+	fs->overruns++;
+	DEBUGMSG(debug_sdl, "T4K_FrameWait(): frame %lu overran by %lu usec\n",
+		fs->frames, (unsigned long)(fs->late_ns / 1000));
+	if (fs->late_ns > fs->frame_ns)
+	    fs->next_ns = now;
+	framestats_add_wait(0, 1);
+    }
+    else
+    {
+	wait_until(fs->next_ns);
+	framestats_add_wait(fs->next_ns - now, 0);
+    }
+
+    fs->next_ns += fs->frame_ns;
+    fs->frames++;
+    return late;
+}
+
+
+static void sleep_ns(Uint64 ns)
+{
+#ifdef HAVE_NANOSLEEP
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+	;
+#else
+    SDL_Delay(ns / 1000000);
+#endif
+}
+
+
+/* Sleep most of the way to deadline, then spin the rest */
+static void wait_until(Uint64 deadline)
+{
+    Uint64 now = T4K_GetTimeNS();
+
+    if (deadline > now + SPIN_NS)
+	sleep_ns(deadline - now - SPIN_NS);
+    while (T4K_GetTimeNS() < deadline)
+	;
 }
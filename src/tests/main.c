@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include "CUnit/Basic.h"
 #include "test_public_functions.h"
+#include "test_kernels.h"
 
 
 
@@ -52,6 +53,36 @@ int main(int argc, char ** argv)
     fprintf(stderr, "CU_add_test: %s\n", CU_get_error_msg());
     return EXIT_FAILURE;
   }
+  test = CU_ADD_TEST(suite, test_T4K_Blend);
+  if (test == NULL)
+  {
+    fprintf(stderr, "CU_add_test: %s\n", CU_get_error_msg());
+    return EXIT_FAILURE;
+  }
+  test = CU_ADD_TEST(suite, test_T4K_zoomEx);
+  if (test == NULL)
+  {
+    fprintf(stderr, "CU_add_test: %s\n", CU_get_error_msg());
+    return EXIT_FAILURE;
+  }
+  test = CU_ADD_TEST(suite, test_T4K_UpdateScreen_retained);
+  if (test == NULL)
+  {
+    fprintf(stderr, "CU_add_test: %s\n", CU_get_error_msg());
+    return EXIT_FAILURE;
+  }
+  test = CU_ADD_TEST(suite, test_kernels_against_reference);
+  if (test == NULL)
+  {
+    fprintf(stderr, "CU_add_test: %s\n", CU_get_error_msg());
+    return EXIT_FAILURE;
+  }
+  test = CU_ADD_TEST(suite, test_zoom_area_against_box_filter);
+  if (test == NULL)
+  {
+    fprintf(stderr, "CU_add_test: %s\n", CU_get_error_msg());
+    return EXIT_FAILURE;
+  }
   
   err = CU_basic_run_suite(suite);
   if (err != CUE_SUCCESS)
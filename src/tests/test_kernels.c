@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CUnit/Basic.h"
+#include "t4k_common.h"
+#include "test_kernels.h"
+
+
+
+/* Golden-image checks of the fast pixel paths: every operation is run */
+/* once with T4K_SetReferenceKernels(1), which gives the original      */
+/* generic code, and once normally, on random surfaces of several      */
+/* formats, odd sizes and padded pitches. The results must agree to    */
+/* within each operation's tolerance (per channel, 0 - 255). The times */
+/* of both are printed side by side.                                   */
+
+typedef struct test_format
+{
+  const char * name;
+  int bpp;
+  Uint32 red, green, blue, alpha;  // masks
+} test_format;
+
+static const test_format formats[] = {
+  {"RGB565",   16, 0xf800,   0x07e0,   0x001f,   0},
+  {"RGB888",   24, 0xff0000, 0x00ff00, 0x0000ff, 0},
+  {"XRGB8888", 32, 0xff0000, 0x00ff00, 0x0000ff, 0},
+  {"ARGB8888", 32, 0xff0000, 0x00ff00, 0x0000ff, 0xff000000},
+  {"ABGR8888", 32, 0x0000ff, 0x00ff00, 0xff0000, 0xff000000},
+};
+#define NUM_FORMATS (int) (sizeof(formats) / sizeof(formats[0]))
+
+/* odd sizes, to cover the leftover pixels of the SIMD loops */
+static const int sizes[][2] = {
+  {1, 1}, {3, 7}, {37, 23}, {64, 17}, {129, 65}, {319, 241}
+};
+#define NUM_SIZES (int) (sizeof(sizes) / sizeof(sizes[0]))
+
+
+/* An operation returns a new surface made from src (and src2, which  */
+/* has the same width and may be shorter), or for the in_place ones,  */
+/* draws on dst, a copy of src, and returns it.                        */
+typedef SDL_Surface * (*KernelOp)(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst);
+
+typedef struct kernel_op
+{
+  const char * name;
+  KernelOp run;
+  int only32;     // needs 32 bit surfaces
+  int in_place;
+  int tolerance;
+} kernel_op;
+
+
+static SDL_Surface * op_zoom_up(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst)
+{
+  (void) src2;
+  (void) dst;
+  return T4K_zoom(src, src->w * 3 / 2 + 1, src->h * 5 / 3 + 1);
+}
+
+static SDL_Surface * op_zoom_down(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst)
+{
+  (void) src2;
+  (void) dst;
+  return T4K_zoom(src, src->w / 3 + 1, src->h / 2 + 1);
+}
+
+static SDL_Surface * op_blend(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst)
+{
+  (void) dst;
+  return T4K_Blend(src, src2, 0.37);
+}
+
+static SDL_Surface * op_fade(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst)
+{
+  (void) src2;
+  (void) dst;
+  return T4K_Blend(src, NULL, 0.6);
+}
+
+static SDL_Surface * op_blend_into(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst)
+{
+  T4K_BlendInto(dst, src, src2, 0.25, NULL);
+  return dst;
+}
+
+static SDL_Surface * op_flip_x(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst)
+{
+  (void) src2;
+  (void) dst;
+  return T4K_Flip(src, 1, 0);
+}
+
+static SDL_Surface * op_flip_y(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst)
+{
+  (void) src2;
+  (void) dst;
+  return T4K_Flip(src, 0, 1);
+}
+
+static SDL_Surface * op_flip_xy(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst)
+{
+  (void) src2;
+  (void) dst;
+  return T4K_Flip(src, 1, 1);
+}
+
+static SDL_Surface * op_darken(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst)
+{
+  SDL_Surface * old_screen = screen;
+
+  (void) src;
+  (void) src2;
+  // T4K_DarkenScreen() only works on the screen
+  screen = dst;
+  T4K_DarkenScreen(1);
+  screen = old_screen;
+  return dst;
+}
+
+static SDL_Surface * op_rounded_rect(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst)
+{
+  SDL_Rect r;
+
+  (void) src2;
+  r.x = 1;
+  r.y = 1;
+  r.w = src->w - 1;
+  r.h = src->h - 1;
+  T4K_FillRoundedRect(dst, &r, (r.w < r.h ? r.w : r.h) / 3, 200, 100, 50, 160);
+  return dst;
+}
+
+static SDL_Surface * op_blit_premultiplied(SDL_Surface * src, SDL_Surface * src2, SDL_Surface * dst)
+{
+  SDL_Rect r;
+
+  (void) src;
+  // (src2 stays premultiplied for the second run)
+  if (src2->format->Amask && T4K_PremultiplyAlpha(src2))
+  {
+    r.x = 2;
+    r.y = 1;
+    T4K_BlitPremultiplied(src2, NULL, dst, &r);
+  }
+  return dst;
+}
+
+
+/* The generic zoom and blend code works in float and truncates (twice, */
+/* for blended alpha), while the fast code rounds 8.8 fixed point, so    */
+/* they may differ by a little more than 1.                               */
+static const kernel_op ops[] = {
+  {"zoom up",       op_zoom_up,      0, 0, 3},
+  {"zoom down",     op_zoom_down,    0, 0, 3},
+  {"blend",         op_blend,        1, 0, 2},
+  {"fade",          op_fade,         1, 0, 2},
+  {"blend into",    op_blend_into,   1, 1, 2},
+  {"flip x",        op_flip_x,       0, 0, 0},
+  {"flip y",        op_flip_y,       0, 0, 0},
+  {"flip xy",       op_flip_xy,      0, 0, 0},
+  {"darken",        op_darken,       0, 1, 0},
+  {"rounded rect",  op_rounded_rect, 0, 1, 1},
+  {"premultiplied", op_blit_premultiplied, 1, 1, 0},
+};
+#define NUM_OPS (int) (sizeof(ops) / sizeof(ops[0]))
+
+
+
+/* A surface in format f with pitch bytes per row (more than it */
+/* needs), filled with noise. Free it with free_test_surface(). */
+static SDL_Surface * make_test_surface(const test_format * f, int w, int h, int pitch)
+{
+  Uint8 * pixels = malloc(pitch * h);
+  SDL_Surface * s;
+  int i;
+
+  if (pixels == NULL)
+    return NULL;
+  for (i = 0; i < pitch * h; i++)
+    pixels[i] = rand() >> 4;
+  s = SDL_CreateRGBSurfaceFrom(pixels, w, h, f->bpp, pitch,
+                               f->red, f->green, f->blue, f->alpha);
+  if (s == NULL)
+    free(pixels);
+  return s;
+}
+
+static SDL_Surface * copy_test_surface(const test_format * f, SDL_Surface * src)
+{
+  SDL_Surface * s = make_test_surface(f, src->w, src->h, src->pitch);
+
+  if (s != NULL)
+    memcpy(s->pixels, src->pixels, src->pitch * src->h);
+  return s;
+}
+
+static void free_test_surface(SDL_Surface * s)
+{
+  void * pixels;
+
+  if (s == NULL)
+    return;
+  pixels = s->pixels;
+  SDL_FreeSurface(s);
+  free(pixels);
+}
+
+
+static Uint32 get_pixel(SDL_Surface * s, int x, int y)
+{
+  Uint8 * p = (Uint8 *) s->pixels + y * s->pitch + x * s->format->BytesPerPixel;
+
+  switch (s->format->BytesPerPixel)
+  {
+    case 1:
+      return *p;
+    case 2:
+      return *(Uint16 *) p;
+    case 3:
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+      return p[0] << 16 | p[1] << 8 | p[2];
+#else
+      return p[0] | p[1] << 8 | p[2] << 16;
+#endif
+    default:
+      return *(Uint32 *) p;
+  }
+}
+
+/* the biggest difference in any channel of any pixel, */
+/* or 256 if a and b aren't the same size               */
+static int max_error(SDL_Surface * a, SDL_Surface * b)
+{
+  Uint8 ca[4], cb[4];
+  int x, y, i, err = 0;
+
+  if (a->w != b->w || a->h != b->h)
+    return 256;
+  for (y = 0; y < a->h; y++)
+  {
+    for (x = 0; x < a->w; x++)
+    {
+      SDL_GetRGBA(get_pixel(a, x, y), a->format, &ca[0], &ca[1], &ca[2], &ca[3]);
+      SDL_GetRGBA(get_pixel(b, x, y), b->format, &cb[0], &cb[1], &cb[2], &cb[3]);
+      for (i = 0; i < 4; i++)
+        if (abs(ca[i] - cb[i]) > err)
+          err = abs(ca[i] - cb[i]);
+    }
+  }
+  return err;
+}
+
+
+/* Run op on src/src2 with the reference or the fast code, */
+/* adding the time it took to *ns                          */
+static SDL_Surface * run_op(const kernel_op * op, const test_format * f,
+                            SDL_Surface * src, SDL_Surface * src2, int reference, Uint64 * ns)
+{
+  SDL_Surface * dst = NULL;
+  SDL_Surface * ret;
+  Uint64 t0;
+
+  if (op->in_place)
+  {
+    dst = copy_test_surface(f, src);
+    if (dst == NULL)
+      return NULL;
+  }
+  T4K_SetReferenceKernels(reference);
+  t0 = T4K_GetTimeNS();
+  ret = op->run(src, src2, dst);
+  *ns += T4K_GetTimeNS() - t0;
+  T4K_SetReferenceKernels(0);
+  return ret;
+}
+
+static void free_result(const kernel_op * op, SDL_Surface * s)
+{
+  if (op->in_place)
+    free_test_surface(s);
+  else if (s != NULL)
+    SDL_FreeSurface(s);
+}
+
+
+
+void test_kernels_against_reference(void)
+{
+  SDL_Surface * src = NULL;
+  SDL_Surface * src2 = NULL;
+  SDL_Surface * ref = NULL;
+  SDL_Surface * fast = NULL;
+  Uint64 ref_ns, fast_ns;
+  int o, f, i, w, h, err, worst;
+
+  putenv("SDL_VIDEODRIVER=dummy");
+  if (SDL_Init(SDL_INIT_VIDEO) < 0 || SDL_SetVideoMode(64, 64, 32, SDL_SWSURFACE) == NULL)
+  {
+    fprintf(stderr, "Kernel tests aborted: %s\n", SDL_GetError());
+    return;
+  }
+
+  srand(22);
+  printf("\n  %-14s %-10s %8s %10s %10s\n", "operation", "format", "max err", "ref ms", "fast ms");
+
+  for (o = 0; o < NUM_OPS; o++)
+  {
+    for (f = 0; f < NUM_FORMATS; f++)
+    {
+      if (ops[o].only32 && formats[f].bpp != 32)
+        continue;
+
+      ref_ns = fast_ns = 0;
+      worst = 0;
+      for (i = 0; i < NUM_SIZES; i++)
+      {
+        w = sizes[i][0];
+        h = sizes[i][1];
+        // rows padded by 4 to 12 bytes past what they need
+        src = make_test_surface(&formats[f], w, h,
+                                (w * formats[f].bpp / 8 + 3) / 4 * 4 + 4 * (1 + i % 3));
+        src2 = make_test_surface(&formats[f], w, h > 2 ? h - 2 : h,
+                                 (w * formats[f].bpp / 8 + 3) / 4 * 4 + 4 * (1 + (i + 1) % 3));
+        CU_ASSERT_PTR_NOT_NULL_FATAL(src);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(src2);
+
+        ref = run_op(&ops[o], &formats[f], src, src2, 1, &ref_ns);
+        fast = run_op(&ops[o], &formats[f], src, src2, 0, &fast_ns);
+        CU_ASSERT_PTR_NOT_NULL(ref);
+        CU_ASSERT_PTR_NOT_NULL(fast);
+        if (ref != NULL && fast != NULL)
+        {
+          err = max_error(ref, fast);
+          if (err > ops[o].tolerance)
+            fprintf(stderr, "%s %s %dx%d: off by %d\n",
+                    ops[o].name, formats[f].name, w, h, err);
+          CU_ASSERT(err <= ops[o].tolerance);
+          if (err > worst)
+            worst = err;
+        }
+
+        free_result(&ops[o], ref);
+        free_result(&ops[o], fast);
+        free_test_surface(src);
+        free_test_surface(src2);
+      }
+      printf("  %-14s %-10s %8d %10.3f %10.3f\n", ops[o].name, formats[f].name,
+             worst, ref_ns / 1e6, fast_ns / 1e6);
+    }
+  }
+
+  SDL_Quit();
+}
+
+
+
+/* T4K_ZOOM_AREA has no generic version to check against, so it is */
+/* compared with a box filter in double: each output pixel is the   */
+/* average of the source pixels it covers, weighted by how much of  */
+/* each it covers and (for the colors) by alpha.                    */
+static void box_filter(SDL_Surface * src, int w, int h, int x, int y, double * out)
+{
+  double sx = (double) src->w / w, sy = (double) src->h / h;
+  double x0 = x * sx, x1 = (x + 1) * sx, y0 = y * sy, y1 = (y + 1) * sy;
+  double cx, cy, wt, a, sum[4] = {0, 0, 0, 0}, area = 0;
+  Uint8 c[4];
+  int i, j, k;
+
+  for (j = (int) y0; j < y1 && j < src->h; j++)
+  {
+    cy = ((y1 < j + 1) ? y1 : j + 1) - ((y0 > j) ? y0 : j);
+    for (i = (int) x0; i < x1 && i < src->w; i++)
+    {
+      cx = ((x1 < i + 1) ? x1 : i + 1) - ((x0 > i) ? x0 : i);
+      SDL_GetRGBA(get_pixel(src, i, j), src->format, &c[0], &c[1], &c[2], &c[3]);
+      wt = cx * cy;
+      a = src->format->Amask ? c[3] : 255;
+      for (k = 0; k < 3; k++)
+        sum[k] += c[k] * a * wt;
+      sum[3] += a * wt;
+      area += wt;
+    }
+  }
+  for (k = 0; k < 3; k++)
+    out[k] = sum[3] > 0 ? sum[k] / sum[3] : 0;
+  out[3] = sum[3] / area;
+}
+
+void test_zoom_area_against_box_filter(void)
+{
+  static const int sizes[][4] = {
+    {64, 48, 16, 12}, {37, 23, 10, 7}, {129, 65, 40, 31}, {319, 241, 100, 80}, {50, 50, 50, 17}
+  };
+  SDL_Surface * src = NULL;
+  SDL_Surface * ret = NULL;
+  double ref[4];
+  Uint8 c[4];
+  int f, i, x, y, k, err, worst;
+
+  putenv("SDL_VIDEODRIVER=dummy");
+  if (SDL_Init(SDL_INIT_VIDEO) < 0 || SDL_SetVideoMode(64, 64, 32, SDL_SWSURFACE) == NULL)
+  {
+    fprintf(stderr, "Area zoom tests aborted: %s\n", SDL_GetError());
+    return;
+  }
+
+  srand(8);
+  // XRGB8888 and ARGB8888
+  for (f = 2; f <= 3; f++)
+  {
+    worst = 0;
+    for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++)
+    {
+      src = make_test_surface(&formats[f], sizes[i][0], sizes[i][1], sizes[i][0] * 4 + 8);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(src);
+      ret = T4K_zoomEx(src, sizes[i][2], sizes[i][3], T4K_ZOOM_AREA);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(ret);
+      CU_ASSERT(ret->w == sizes[i][2] && ret->h == sizes[i][3]);
+
+      for (y = 0; y < ret->h; y++)
+      {
+        for (x = 0; x < ret->w; x++)
+        {
+          box_filter(src, ret->w, ret->h, x, y, ref);
+          SDL_GetRGBA(get_pixel(ret, x, y), ret->format, &c[0], &c[1], &c[2], &c[3]);
+          for (k = 0; k < 4; k++)
+          {
+            // (colors of nearly clear pixels are too rounded to compare)
+            if (k < 3 && ref[3] < 8)
+              continue;
+            err = abs(c[k] - (int) (ref[k] + 0.5));
+            if (err > worst)
+              worst = err;
+          }
+        }
+      }
+      SDL_FreeSurface(ret);
+      free_test_surface(src);
+    }
+    printf("  %-14s %-10s %8d\n", "zoom area", formats[f].name, worst);
+    CU_ASSERT(worst <= 1);
+  }
+
+  SDL_Quit();
+}
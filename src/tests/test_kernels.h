@@ -0,0 +1,11 @@
+#ifndef TEST_KERNELS_H_
+#define TEST_KERNELS_H_
+
+
+
+void test_kernels_against_reference(void);
+void test_zoom_area_against_box_filter(void);
+
+
+
+#endif
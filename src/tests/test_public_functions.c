@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "CUnit/Basic.h"
 #include "t4k_common.h"
 #include "test_public_functions.h"
@@ -79,3 +80,207 @@ void test_T4K_RemoveSlash(void)
   T4K_RemoveSlash(unixpath);
   CU_ASSERT_STRING_EQUAL(unixpath, "/home/my/unix/path");
 }
+
+
+
+/* compare every channel of T4K_Blend()'s result with the exact blend */
+static int blend_error(SDL_Surface * ret, SDL_Surface * S1, SDL_Surface * S2, float gamma)
+{
+  Uint8 c1[4], c2[4], c[4];
+  int x, y, y2, i, exact, err = 0;
+  
+  for (y = 0; y < S1->h; y++)
+  {
+    y2 = S2 ? y + S2->h - S1->h : -1;
+    for (x = 0; x < S1->w; x++)
+    {
+      SDL_GetRGBA(((Uint32 *) S1->pixels)[y * S1->pitch / 4 + x], S1->format, &c1[0], &c1[1], &c1[2], &c1[3]);
+      SDL_GetRGBA(((Uint32 *) ret->pixels)[y * ret->pitch / 4 + x], ret->format, &c[0], &c[1], &c[2], &c[3]);
+      if (y2 >= 0)
+        SDL_GetRGBA(((Uint32 *) S2->pixels)[y2 * S2->pitch / 4 + x], S2->format, &c2[0], &c2[1], &c2[2], &c2[3]);
+      for (i = 0; i < 4; i++)
+      {
+        if (y2 >= 0)
+          exact = gamma * c1[i] + (1 - gamma) * c2[i];
+        else
+          exact = (i == 3) ? gamma * c1[i] : c1[i];
+        if (abs(exact - c[i]) > err)
+          err = abs(exact - c[i]);
+      }
+    }
+  }
+  return err;
+}
+
+
+
+void test_T4K_Blend(void)
+{
+  SDL_Surface * S1 = NULL;
+  SDL_Surface * S2 = NULL;
+  SDL_Surface * ret = NULL;
+  float gammas[] = {0.0, 0.1, 0.5, 0.77, 1.0};
+  int i;
+  
+  putenv("SDL_VIDEODRIVER=dummy");
+  if (SDL_Init(SDL_INIT_VIDEO) < 0 || SDL_SetVideoMode(64, 64, 32, SDL_SWSURFACE) == NULL)
+  {
+    fprintf(stderr, "T4K_Blend() test aborted: %s\n", SDL_GetError());
+    return;
+  }
+  
+  // odd width, to cover the leftover pixels of the SIMD loops;
+  // S2 is shorter, so the top rows of S1 are just faded
+  S1 = SDL_CreateRGBSurface(SDL_SWSURFACE, 37, 20, 32, 0xff0000, 0xff00, 0xff, 0xff000000);
+  S2 = SDL_CreateRGBSurface(SDL_SWSURFACE, 37, 11, 32, 0xff0000, 0xff00, 0xff, 0xff000000);
+  srand(1);
+  for (i = 0; i < S1->pitch / 4 * S1->h; i++)
+    ((Uint32 *) S1->pixels)[i] = rand() ^ (rand() << 16);
+  for (i = 0; i < S2->pitch / 4 * S2->h; i++)
+    ((Uint32 *) S2->pixels)[i] = rand() ^ (rand() << 16);
+  
+  for (i = 0; i < 5; i++)
+  {
+    ret = T4K_Blend(S1, S2, gammas[i]);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ret);
+    CU_ASSERT(blend_error(ret, S1, S2, gammas[i]) <= 1);
+    SDL_FreeSurface(ret);
+    
+    ret = T4K_Blend(S1, NULL, gammas[i]);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ret);
+    CU_ASSERT(blend_error(ret, S1, NULL, gammas[i]) <= 1);
+    SDL_FreeSurface(ret);
+  }
+  
+  SDL_FreeSurface(S1);
+  SDL_FreeSurface(S2);
+  SDL_Quit();
+}
+
+
+
+/* Area averaging a solid color must give back the same color, with */
+/* or without an alpha channel (opaque surfaces used to come out    */
+/* black, their spare byte being taken for alpha).                  */
+void test_T4K_zoomEx(void)
+{
+  Uint32 amasks[] = {0, 0xff000000};
+  SDL_Surface * src = NULL;
+  SDL_Surface * ret = NULL;
+  Uint8 r, g, b, a;
+  int i, x, y, bad;
+  
+  putenv("SDL_VIDEODRIVER=dummy");
+  if (SDL_Init(SDL_INIT_VIDEO) < 0 || SDL_SetVideoMode(64, 64, 32, SDL_SWSURFACE) == NULL)
+  {
+    fprintf(stderr, "T4K_zoomEx() test aborted: %s\n", SDL_GetError());
+    return;
+  }
+  
+  for (i = 0; i < 2; i++)
+  {
+    src = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 32, 0xff0000, 0xff00, 0xff, amasks[i]);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(src);
+    SDL_FillRect(src, NULL, SDL_MapRGBA(src->format, 200, 100, 50, 255));
+    
+    ret = T4K_zoomEx(src, 16, 16, T4K_ZOOM_AREA);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ret);
+    bad = 0;
+    for (y = 0; y < ret->h; y++)
+    {
+      for (x = 0; x < ret->w; x++)
+      {
+        SDL_GetRGBA(((Uint32 *) ret->pixels)[y * ret->pitch / 4 + x], ret->format, &r, &g, &b, &a);
+        if (r != 200 || g != 100 || b != 50 || a != 255)
+          bad++;
+      }
+    }
+    CU_ASSERT_EQUAL(bad, 0);
+    
+    SDL_FreeSurface(ret);
+    SDL_FreeSurface(src);
+  }
+  SDL_Quit();
+}
+
+
+
+/* A sprite moving under a translucent retained draw is erased and */
+/* redrawn in overlapping rects every frame. The retained draw has */
+/* to be blended over it once, however many of those rects a pixel */
+/* falls in.                                                       */
+void test_T4K_UpdateScreen_retained(void)
+{
+  SDL_Surface * bkgd = NULL;
+  SDL_Surface * sprite = NULL;
+  SDL_Surface * panel = NULL;
+  SDL_Surface * ref = NULL;
+  SDL_Rect dst;
+  Uint8 c1[4], c2[4];
+  int frame = 0;
+  int i, x, y, bad;
+  
+  putenv("SDL_VIDEODRIVER=dummy");
+  if (SDL_Init(SDL_INIT_VIDEO) < 0 || (screen = SDL_SetVideoMode(64, 64, 32, SDL_SWSURFACE)) == NULL)
+  {
+    fprintf(stderr, "T4K_UpdateScreen() test aborted: %s\n", SDL_GetError());
+    return;
+  }
+  T4K_InitBlitQueue();
+  
+  bkgd = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 32, 0xff0000, 0xff00, 0xff, 0);
+  sprite = SDL_CreateRGBSurface(SDL_SWSURFACE, 16, 16, 32, 0xff0000, 0xff00, 0xff, 0);
+  panel = SDL_CreateRGBSurface(SDL_SWSURFACE, 32, 32, 32, 0xff0000, 0xff00, 0xff, 0xff000000);
+  ref = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 32, 0xff0000, 0xff00, 0xff, 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(bkgd);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(sprite);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(panel);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ref);
+  SDL_FillRect(bkgd, NULL, SDL_MapRGB(bkgd->format, 0, 0, 200));
+  SDL_FillRect(sprite, NULL, SDL_MapRGB(sprite->format, 200, 0, 0));
+  SDL_FillRect(panel, NULL, SDL_MapRGBA(panel->format, 255, 255, 255, 128));
+  SDL_SetAlpha(panel, SDL_SRCALPHA, SDL_ALPHA_OPAQUE);
+  
+  SDL_BlitSurface(bkgd, NULL, screen, NULL);
+  T4K_SetLayerRetained(T4K_LAYER_HUD, 1);
+  T4K_DrawObjectOnLayer(panel, 16, 16, T4K_LAYER_HUD);
+  T4K_DrawObject(sprite, 10, 10);
+  T4K_UpdateScreen(&frame);
+  for (i = 0; i < 3; i++)
+  {
+    T4K_EraseObject(sprite, bkgd, 10 + 4 * i, 10 + 4 * i);
+    T4K_DrawObject(sprite, 14 + 4 * i, 14 + 4 * i);
+    T4K_UpdateScreen(&frame);
+  }
+  
+  // what the screen should look like: each surface blitted once
+  SDL_BlitSurface(bkgd, NULL, ref, NULL);
+  dst.x = dst.y = 22;
+  SDL_BlitSurface(sprite, NULL, ref, &dst);
+  dst.x = dst.y = 16;
+  SDL_BlitSurface(panel, NULL, ref, &dst);
+  
+  bad = 0;
+  for (y = 0; y < 64; y++)
+  {
+    for (x = 0; x < 64; x++)
+    {
+      SDL_GetRGB(((Uint32 *) screen->pixels)[y * screen->pitch / 4 + x], screen->format, &c1[0], &c1[1], &c1[2]);
+      SDL_GetRGB(((Uint32 *) ref->pixels)[y * ref->pitch / 4 + x], ref->format, &c2[0], &c2[1], &c2[2]);
+      for (i = 0; i < 3; i++)
+        if (abs(c1[i] - c2[i]) > 2)
+          break;
+      bad += (i < 3);
+    }
+  }
+  CU_ASSERT_EQUAL(bad, 0);
+  
+  T4K_ClearLayer(T4K_LAYER_HUD);
+  T4K_SetLayerRetained(T4K_LAYER_HUD, 0);
+  SDL_FreeSurface(ref);
+  SDL_FreeSurface(panel);
+  SDL_FreeSurface(sprite);
+  SDL_FreeSurface(bkgd);
+  SDL_Quit();
+  screen = NULL;
+}
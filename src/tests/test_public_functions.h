@@ -6,6 +6,9 @@
 void test_T4K_inRect(void);
 void test_T4K_CheckFile(void);
 void test_T4K_RemoveSlash(void);
+void test_T4K_Blend(void);
+void test_T4K_zoomEx(void);
+void test_T4K_UpdateScreen_retained(void);
 
 
 